@@ -14,6 +14,7 @@ connection_pool::connection_pool()
 {
 	m_CurConn = 0;
 	m_FreeConn = 0;
+	m_MaxConn = 0;
 }
 
 connection_pool *connection_pool::GetInstance()
@@ -64,7 +65,8 @@ MYSQL *connection_pool::GetConnection()
 {
 	MYSQL *con = NULL;
 
-	if (0 == connList.size())
+	//未初始化时返回NULL;连接都被占用时等待归还,而不是返回NULL
+	if (0 == m_MaxConn)
 		return NULL;
 
 	reserve.wait();
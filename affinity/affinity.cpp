@@ -0,0 +1,143 @@
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include "affinity.h"
+
+bool Affinity::parse_cpus(const string &list, vector<int> &cpus)
+{
+    cpus.clear();
+    const char *p = list.c_str();
+    while (*p)
+    {
+        char *end;
+        long first = strtol(p, &end, 10);
+        if (end == p || first < 0)
+            return false;
+        long last = first;
+        p = end;
+        if (*p == '-')
+        {
+            last = strtol(p + 1, &end, 10);
+            if (end == p + 1 || last < first)
+                return false;
+            p = end;
+        }
+        if (last >= CPU_SETSIZE)
+            return false;
+        for (long cpu = first; cpu <= last; ++cpu)
+            cpus.push_back(cpu);
+        if (*p == ',')
+            ++p;
+        else if (*p && *p != '\n')
+            return false;
+        else
+            break;
+    }
+    return !cpus.empty();
+}
+
+int Affinity::pin(pthread_t thread, const vector<int> &cpus)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (size_t i = 0; i < cpus.size(); ++i)
+        CPU_SET(cpus[i], &set);
+    return pthread_setaffinity_np(thread, sizeof(set), &set);
+}
+
+bool Affinity::init(int node, const string &loop_cpus, const string &worker_cpus)
+{
+    if (!loop_cpus.empty() && !parse_cpus(loop_cpus, m_loop))
+    {
+        printf("invalid cpu list: %s\n", loop_cpus.c_str());
+        return false;
+    }
+    if (!worker_cpus.empty() && !parse_cpus(worker_cpus, m_workers))
+    {
+        printf("invalid cpu list: %s\n", worker_cpus.c_str());
+        return false;
+    }
+
+    if (node >= 0)
+    {
+        char path[64], buf[1024];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+        FILE *fp = fopen(path, "r");
+        vector<int> node_cpus;
+        bool ok = fp && fgets(buf, sizeof(buf), fp) && parse_cpus(buf, node_cpus);
+        if (fp)
+            fclose(fp);
+        if (!ok)
+        {
+            printf("numa node %d not found\n", node);
+            return false;
+        }
+        //事件循环默认用节点的第一个CPU,工作线程用其余的
+        if (m_loop.empty())
+            m_loop.push_back(node_cpus[0]);
+        if (m_workers.empty())
+        {
+            for (size_t i = 0; i < node_cpus.size(); ++i)
+            {
+                if (node_cpus[i] != m_loop[0] || node_cpus.size() == 1)
+                    m_workers.push_back(node_cpus[i]);
+            }
+        }
+
+        //首次写入时分配物理页,连接池等在之后分配,优先放在该节点;节点内存不足时可以退到其他节点
+        unsigned long mask[16];
+        memset(mask, 0, sizeof(mask));
+        if (node >= (int)sizeof(mask) * 8)
+            return false;
+        mask[node / (8 * sizeof(long))] = 1UL << (node % (8 * sizeof(long)));
+        if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask, sizeof(mask) * 8) < 0)
+            printf("set_mempolicy failed: %s\n", strerror(errno));
+    }
+
+    //先把整个进程限制在配置的CPU上,日志等后台线程继承,不会跑到其他节点
+    vector<int> all = m_loop;
+    all.insert(all.end(), m_workers.begin(), m_workers.end());
+    int err = all.empty() ? 0 : pin(pthread_self(), all);
+    if (err)
+    {
+        printf("sched_setaffinity failed: %s\n", strerror(err));
+        return false;
+    }
+    return true;
+}
+
+void Affinity::pin_loop()
+{
+    if (!m_loop.empty())
+        pin(pthread_self(), m_loop);
+}
+
+void Affinity::pin_worker(pthread_t thread, int index)
+{
+    if (m_workers.empty())
+        return;
+    vector<int> one(1, m_workers[index % m_workers.size()]);
+    pin(thread, one);
+}
+
+bool Affinity::local(int cpu)
+{
+    if (m_loop.empty() && m_workers.empty())
+        return true;
+    for (size_t i = 0; i < m_loop.size(); ++i)
+    {
+        if (m_loop[i] == cpu)
+            return true;
+    }
+    for (size_t i = 0; i < m_workers.size(); ++i)
+    {
+        if (m_workers[i] == cpu)
+            return true;
+    }
+    return false;
+}
@@ -0,0 +1,48 @@
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+//事件循环和工作线程的CPU亲和性,以及NUMA节点的内存分配策略
+//未配置时不做任何设置,线程由调度器决定
+class Affinity
+{
+public:
+    static Affinity *get_instance()
+    {
+        static Affinity instance;
+        return &instance;
+    }
+
+    //node为NUMA节点,-1表示不指定;loop_cpus、worker_cpus为CPU列表,如"0-3,8",为空时取节点的CPU
+    //须在分配连接池和创建线程之前调用:之后分配的内存优先放在该节点,新线程继承这些CPU
+    bool init(int node, const string &loop_cpus, const string &worker_cpus);
+
+    //调用线程绑定到事件循环的CPU
+    void pin_loop();
+    //第index个工作线程绑定到worker_cpus中的一个CPU,依次轮流
+    void pin_worker(pthread_t thread, int index);
+
+    //事件循环的第一个CPU,未配置时为-1
+    int loop_cpu() { return m_loop.empty() ? -1 : m_loop[0]; }
+    //是否为配置的CPU之一,未配置时总为true
+    bool local(int cpu);
+
+    static bool parse_cpus(const string &list, vector<int> &cpus);
+
+private:
+    Affinity() {}
+    ~Affinity() {}
+    //返回0或错误码
+    static int pin(pthread_t thread, const vector<int> &cpus);
+
+private:
+    vector<int> m_loop;
+    vector<int> m_workers;
+};
+
+#endif
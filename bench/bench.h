@@ -0,0 +1,44 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdio.h>
+#include <string>
+#include "../metrics/metrics.h"
+
+using namespace std;
+
+//组件微基准测试,每个结果输出一行JSON,便于跨版本比较
+struct bench_options
+{
+    long long scale;   //迭代次数的缩放系数,默认1
+    string filter;     //只运行名字包含该子串的测试
+    string tmpdir;     //日志等临时文件目录
+    string doc_root;   //http解析测试使用的网站根目录
+    string db;         //user:passwd@host:port/dbname,为空时跳过连接池测试
+};
+
+extern bench_options g_bench;
+
+inline long long bench_now_ns()
+{
+    return metrics_now_ns();
+}
+
+inline bool bench_enabled(const char *name)
+{
+    return g_bench.filter.empty() || string(name).find(g_bench.filter) != string::npos;
+}
+
+//ops次操作共耗时elapsed_ns,syscalls不小于0时一并输出每次操作的系统调用数
+void bench_report(const char *name, const char *param, long long ops, long long elapsed_ns, long long syscalls = -1);
+void bench_skip(const char *name, const char *reason);
+
+void bench_http();
+void bench_timer();
+void bench_threadpool();
+void bench_block_queue();
+void bench_log();
+void bench_sql_pool();
+void bench_epoll();
+
+#endif
@@ -0,0 +1,171 @@
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <vector>
+#include "bench.h"
+
+//模拟proactor下keep-alive请求在事件循环中的处理,每轮conns个连接各发一个请求:
+//收到请求 -> 交给工作线程 -> 工作线程要求发送 -> 发出响应 -> 等待下一个请求
+//只统计事件循环一侧的系统调用,客户端的读写不计入
+
+static const char s_request[] = "GET / HTTP/1.1\r\nHost: localhost\r\nConnection: keep-alive\r\n\r\n";
+static const char s_response[] = "HTTP/1.1 200 OK\r\nContent-Length:0\r\nConnection:keep-alive\r\n\r\n";
+static const int MAX_CONNS = 64;
+
+struct epoll_bench
+{
+    int epfd;
+    int notify;
+    int conns;
+    int server[MAX_CONNS];
+    int client[MAX_CONNS];
+    long long calls;
+    epoll_event events[MAX_CONNS + 1];
+};
+
+//等待count个事件,返回的事件在events中依次处理
+template <class F>
+static void wait_events(epoll_bench &b, int count, F handle)
+{
+    while (count > 0)
+    {
+        int n = epoll_wait(b.epfd, b.events, MAX_CONNS + 1, -1);
+        b.calls++;
+        for (int i = 0; i < n; ++i)
+            count -= handle(b.events[i]);
+    }
+}
+
+static void clients_send(epoll_bench &b)
+{
+    for (int c = 0; c < b.conns; ++c)
+        ::write(b.client[c], s_request, sizeof(s_request) - 1);
+}
+
+static void clients_recv(epoll_bench &b)
+{
+    char buf[1024];
+    for (int c = 0; c < b.conns; ++c)
+        ::read(b.client[c], buf, sizeof(buf));
+}
+
+static void modfd(epoll_bench &b, int fd, unsigned ev)
+{
+    epoll_event event;
+    event.data.fd = fd;
+    event.events = ev | EPOLLRDHUP | EPOLLONESHOT;
+    epoll_ctl(b.epfd, EPOLL_CTL_MOD, fd, &event);
+    b.calls++;
+}
+
+//EPOLLONESHOT + LT:每次交接都要EPOLL_CTL_MOD重新注册
+static void round_oneshot(epoll_bench &b)
+{
+    char buf[1024];
+    clients_send(b);
+    wait_events(b, b.conns, [&](epoll_event &e) {
+        recv(e.data.fd, buf, sizeof(buf), 0);
+        //工作线程处理完后注册写事件
+        modfd(b, e.data.fd, EPOLLOUT);
+        b.calls++;
+        return 1;
+    });
+    wait_events(b, b.conns, [&](epoll_event &e) {
+        send(e.data.fd, s_response, sizeof(s_response) - 1, MSG_NOSIGNAL);
+        //发完后重新注册读事件
+        modfd(b, e.data.fd, EPOLLIN);
+        b.calls++;
+        return 1;
+    });
+    clients_recv(b);
+}
+
+//ET注册一次读写事件:须读到EAGAIN,工作线程通过eventfd交还连接,同一批只需唤醒一次
+static void round_interest(epoll_bench &b)
+{
+    char buf[1024];
+    clients_send(b);
+    wait_events(b, b.conns, [&](epoll_event &e) {
+        if (e.data.fd == b.notify)
+            return 0;
+        while (recv(e.data.fd, buf, sizeof(buf), 0) > 0)
+            b.calls++;
+        b.calls++;
+        return 1;
+    });
+    uint64_t one = 1;
+    ::write(b.notify, &one, sizeof(one));
+    b.calls++;
+    wait_events(b, 1, [&](epoll_event &e) {
+        return e.data.fd == b.notify ? 1 : 0;
+    });
+    //写就绪在注册时已通知过且未写满,直接发送
+    for (int c = 0; c < b.conns; ++c)
+    {
+        send(b.server[c], s_response, sizeof(s_response) - 1, MSG_NOSIGNAL);
+        b.calls++;
+    }
+    clients_recv(b);
+}
+
+void bench_epoll()
+{
+    if (!bench_enabled("epoll"))
+        return;
+
+    static const int conns[] = {1, 16, 64};
+    for (size_t k = 0; k < sizeof(conns) / sizeof(conns[0]); ++k)
+    {
+        for (int mode = 0; mode < 2; ++mode)
+        {
+            epoll_bench b;
+            b.epfd = epoll_create1(0);
+            b.notify = eventfd(0, EFD_NONBLOCK);
+            b.conns = conns[k];
+            epoll_event event;
+            event.data.fd = b.notify;
+            event.events = EPOLLIN | EPOLLET;
+            epoll_ctl(b.epfd, EPOLL_CTL_ADD, b.notify, &event);
+            for (int c = 0; c < b.conns; ++c)
+            {
+                int fds[2];
+                socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+                fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+                b.server[c] = fds[0];
+                b.client[c] = fds[1];
+                event.data.fd = fds[0];
+                event.events = mode ? EPOLLIN | EPOLLOUT | EPOLLET | EPOLLRDHUP : EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+                epoll_ctl(b.epfd, EPOLL_CTL_ADD, fds[0], &event);
+            }
+            //注册时socket可写的通知不计入
+            if (mode)
+                epoll_wait(b.epfd, b.events, MAX_CONNS + 1, 0);
+
+            long long rounds = 200000 * g_bench.scale / b.conns;
+            b.calls = 0;
+            long long t0 = bench_now_ns();
+            for (long long r = 0; r < rounds; ++r)
+            {
+                if (mode)
+                    round_interest(b);
+                else
+                    round_oneshot(b);
+            }
+            long long elapsed = bench_now_ns() - t0;
+
+            char param[32];
+            snprintf(param, sizeof(param), "%s,conns=%d", mode ? "interest" : "oneshot", b.conns);
+            bench_report("epoll_rearm", param, rounds * b.conns, elapsed, b.calls);
+
+            for (int c = 0; c < b.conns; ++c)
+            {
+                close(b.server[c]);
+                close(b.client[c]);
+            }
+            close(b.notify);
+            close(b.epfd);
+        }
+    }
+}
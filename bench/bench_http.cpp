@@ -0,0 +1,127 @@
+#include <string.h>
+#include "bench.h"
+#include "../http/http_conn.h"
+
+//抓取的浏览器请求
+static const char *req_get =
+    "GET /test1.jpg HTTP/1.1\r\n"
+    "Host: 192.168.1.10:9006\r\n"
+    "Connection: keep-alive\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/118.0.0.0 Safari/537.36\r\n"
+    "Accept: image/avif,image/webp,image/apng,image/svg+xml,image/*,*/*;q=0.8\r\n"
+    "Referer: http://192.168.1.10:9006/5\r\n"
+    "Accept-Encoding: gzip, deflate\r\n"
+    "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+    "\r\n";
+
+static const char *req_post =
+    "POST /2CGISQL.cgi HTTP/1.1\r\n"
+    "Host: 192.168.1.10:9006\r\n"
+    "Connection: keep-alive\r\n"
+    "Content-Length: 25\r\n"
+    "Cache-Control: max-age=0\r\n"
+    "Origin: http://192.168.1.10:9006\r\n"
+    "Content-Type: application/x-www-form-urlencoded\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/118.0.0.0 Safari/537.36\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+    "Referer: http://192.168.1.10:9006/log.html\r\n"
+    "Accept-Encoding: gzip, deflate\r\n"
+    "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+    "\r\n"
+    "user=name&password=passwd";
+
+//http_conn的友元,直接驱动私有的解析函数
+class http_conn_bench
+{
+public:
+    static void setup(http_conn *c, char *root)
+    {
+        c->m_sockfd = -1;
+        c->doc_root = root;
+        c->m_close_log = 1;
+        c->m_TRIGMode = 0;
+        c->m_read_idx = 0;
+        c->m_checked_idx = 0;
+        c->init();
+    }
+
+    static void load(http_conn *c, const char *req, int len)
+    {
+        memcpy(c->m_read_buf, req, len);
+        c->m_read_idx = len;
+        c->m_checked_idx = 0;
+        c->m_start_line = 0;
+        c->m_check_state = http_conn::CHECK_STATE_REQUESTLINE;
+    }
+
+    //只做分行
+    static int split_lines(http_conn *c)
+    {
+        int lines = 0;
+        while (c->parse_line() == http_conn::LINE_OK)
+            lines++;
+        return lines;
+    }
+
+    static http_conn::HTTP_CODE process_read(http_conn *c)
+    {
+        http_conn::HTTP_CODE ret = c->process_read();
+        c->release_body();
+        c->init();
+        return ret;
+    }
+};
+
+void bench_http()
+{
+    http_conn *c = new http_conn;
+    char *root = (char *)g_bench.doc_root.c_str();
+    http_conn_bench::setup(c, root);
+    Metrics::get_instance()->init(false, "/metrics");
+    http_conn::init_routes();
+
+    const char *reqs[] = {req_get, req_post};
+    const char *names[] = {"get", "post"};
+    //登录请求解析完成后交给数据库执行器,只测到交接为止
+    const char *read_names[] = {"get", "post_db_handoff"};
+    const http_conn::HTTP_CODE expect[] = {http_conn::FILE_REQUEST, http_conn::DB_REQUEST};
+    const char *fail[] = {"request failed, check -r doc_root", "login was not handed to the DB executor"};
+    for (int r = 0; r < 2; ++r)
+    {
+        int len = strlen(reqs[r]);
+        long long ops = 1000000 * g_bench.scale;
+
+        if (bench_enabled("http_parse_line"))
+        {
+            long long lines = 0;
+            long long t0 = bench_now_ns();
+            for (long long i = 0; i < ops; ++i)
+            {
+                http_conn_bench::load(c, reqs[r], len);
+                lines += http_conn_bench::split_lines(c);
+            }
+            bench_report("http_parse_line", names[r], ops, bench_now_ns() - t0);
+            if (lines == 0)
+                bench_skip("http_parse_line", "no lines parsed");
+        }
+
+        //包含do_request,GET会stat并打开文件,POST到返回DB_REQUEST为止
+        if (bench_enabled("http_process_read"))
+        {
+            ops = 200000 * g_bench.scale;
+            http_conn::HTTP_CODE ret = http_conn::NO_REQUEST;
+            long long t0 = bench_now_ns();
+            for (long long i = 0; i < ops; ++i)
+            {
+                http_conn_bench::load(c, reqs[r], len);
+                ret = http_conn_bench::process_read(c);
+            }
+            long long elapsed = bench_now_ns() - t0;
+            if (ret != expect[r])
+                bench_skip("http_process_read", fail[r]);
+            else
+                bench_report("http_process_read", read_names[r], ops, elapsed);
+        }
+    }
+    delete c;
+}
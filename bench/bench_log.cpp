@@ -0,0 +1,73 @@
+#include <pthread.h>
+#include <sched.h>
+#include "bench.h"
+#include "../log/block_queue.h"
+#include "../log/log.h"
+
+static void *queue_consumer(void *arg)
+{
+    block_queue<int> *q = (block_queue<int> *)arg;
+    int v = 0;
+    while (q->pop(v) && v >= 0)
+        ;
+    return NULL;
+}
+
+void bench_block_queue()
+{
+    if (!bench_enabled("block_queue"))
+        return;
+
+    long long ops = 2000000 * g_bench.scale;
+    block_queue<int> q(1000);
+    int v = 0;
+
+    //单线程交替push/pop
+    long long t0 = bench_now_ns();
+    for (long long i = 0; i < ops; ++i)
+    {
+        q.push(1);
+        q.pop(v);
+    }
+    bench_report("block_queue_push_pop", "threads=1", ops, bench_now_ns() - t0);
+
+    //一个生产者一个消费者,队列满时push返回false,生产者重试
+    pthread_t tid;
+    pthread_create(&tid, NULL, queue_consumer, &q);
+    t0 = bench_now_ns();
+    for (long long i = 0; i < ops; ++i)
+    {
+        while (!q.push(1))
+            sched_yield();
+    }
+    while (!q.push(-1))
+        sched_yield();
+    pthread_join(tid, NULL);
+    bench_report("block_queue_push_pop", "threads=2", ops, bench_now_ns() - t0);
+}
+
+void bench_log()
+{
+    if (!bench_enabled("log_write"))
+        return;
+
+    //日志是单例,先测同步写,再切换为异步
+    int m_close_log = 0;
+    string file = g_bench.tmpdir + "/bench_ServerLog";
+    long long ops = 500000 * g_bench.scale;
+    const char *modes[] = {"sync", "async"};
+    for (int m = 0; m < 2; ++m)
+    {
+        if (!Log::get_instance()->init(file.c_str(), 0, 2000, 800000, m == 0 ? 0 : 800))
+        {
+            bench_skip("log_write", "cannot open log file, check -d");
+            return;
+        }
+        long long t0 = bench_now_ns();
+        for (long long i = 0; i < ops; ++i)
+        {
+            LOG_INFO("deal with the client(%s) fd %d url %s", "127.0.0.1", (int)i, "/test1.jpg");
+        }
+        bench_report("log_write", modes[m], ops, bench_now_ns() - t0);
+    }
+}
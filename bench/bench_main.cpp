@@ -0,0 +1,87 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include "bench.h"
+
+bench_options g_bench;
+
+void bench_report(const char *name, const char *param, long long ops, long long elapsed_ns, long long syscalls)
+{
+    double ns_per_op = ops ? (double)elapsed_ns / ops : 0;
+    double ops_per_sec = elapsed_ns ? ops * 1e9 / elapsed_ns : 0;
+    printf("{\"bench\":\"%s\",\"param\":\"%s\",\"ops\":%lld,\"elapsed_ns\":%lld,\"ns_per_op\":%.2f,\"ops_per_sec\":%.1f",
+           name, param, ops, elapsed_ns, ns_per_op, ops_per_sec);
+    if (syscalls >= 0)
+        printf(",\"syscalls_per_op\":%.2f", ops ? (double)syscalls / ops : 0);
+    printf("}\n");
+    fflush(stdout);
+}
+
+void bench_skip(const char *name, const char *reason)
+{
+    printf("{\"bench\":\"%s\",\"skipped\":\"%s\"}\n", name, reason);
+    fflush(stdout);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [-f filter] [-s scale] [-d tmpdir] [-r doc_root] [-b user:passwd@host:port/db]\n"
+            "  -f  only run benchmarks whose name contains filter\n"
+            "  -s  multiply iteration counts by scale (default 1)\n"
+            "  -d  directory for temporary log files (default /tmp)\n"
+            "  -r  document root for http parsing (default ./root)\n"
+            "  -b  MySQL connection for the connection pool benchmark\n",
+            prog);
+}
+
+int main(int argc, char *argv[])
+{
+    g_bench.scale = 1;
+    g_bench.tmpdir = "/tmp";
+    char cwd[200];
+    if (getcwd(cwd, sizeof(cwd)))
+        g_bench.doc_root = string(cwd) + "/root";
+
+    int opt;
+    while ((opt = getopt(argc, argv, "f:s:d:r:b:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'f':
+            g_bench.filter = optarg;
+            break;
+        case 's':
+            g_bench.scale = atoll(optarg) > 0 ? atoll(optarg) : 1;
+            break;
+        case 'd':
+            g_bench.tmpdir = optarg;
+            break;
+        case 'r':
+            g_bench.doc_root = optarg;
+            break;
+        case 'b':
+            g_bench.db = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    char host[64] = "";
+    gethostname(host, sizeof(host) - 1);
+    printf("{\"suite\":\"tinywebserver-microbench\",\"host\":\"%s\",\"time\":%ld,\"cpus\":%ld}\n",
+           host, (long)time(NULL), sysconf(_SC_NPROCESSORS_ONLN));
+
+    bench_http();
+    bench_timer();
+    bench_threadpool();
+    bench_block_queue();
+    bench_log();
+    bench_sql_pool();
+    bench_epoll();
+    return 0;
+}
@@ -0,0 +1,73 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "bench.h"
+#include "../CGImysql/sql_connection_pool.h"
+
+static const int SQL_POOL_SIZE = 8;
+
+struct sql_bench_arg
+{
+    connection_pool *pool;
+    long long ops;
+};
+
+static void *checkout_worker(void *arg)
+{
+    sql_bench_arg *a = (sql_bench_arg *)arg;
+    for (long long i = 0; i < a->ops; ++i)
+    {
+        MYSQL *mysql = NULL;
+        connectionRAII mysqlcon(&mysql, a->pool);
+    }
+    return NULL;
+}
+
+void bench_sql_pool()
+{
+    if (!bench_enabled("sql_pool_checkout"))
+        return;
+    if (g_bench.db.empty())
+    {
+        bench_skip("sql_pool_checkout", "no -b user:passwd@host:port/db given");
+        return;
+    }
+
+    //user:passwd@host:port/db
+    char buf[256] = {0};
+    strncpy(buf, g_bench.db.c_str(), sizeof(buf) - 1);
+    char *at = strchr(buf, '@');
+    char *colon = strchr(buf, ':');
+    char *slash = at ? strchr(at, '/') : NULL;
+    char *port = at ? strchr(at, ':') : NULL;
+    if (!at || !colon || colon > at || !slash || !port || port > slash)
+    {
+        bench_skip("sql_pool_checkout", "bad -b format");
+        return;
+    }
+    *colon = *at = *port = *slash = '\0';
+
+    connection_pool *pool = connection_pool::GetInstance();
+    pool->init(at + 1, buf, colon + 1, slash + 1, atoi(port + 1), SQL_POOL_SIZE, 1);
+
+    static const int threads[] = {1, 8, 32};
+    for (size_t t = 0; t < sizeof(threads) / sizeof(threads[0]); ++t)
+    {
+        int n = threads[t];
+        sql_bench_arg arg;
+        arg.pool = pool;
+        arg.ops = 200000 * g_bench.scale / n;
+        pthread_t *tids = new pthread_t[n];
+        long long t0 = bench_now_ns();
+        for (int i = 0; i < n; ++i)
+            pthread_create(&tids[i], NULL, checkout_worker, &arg);
+        for (int i = 0; i < n; ++i)
+            pthread_join(tids[i], NULL);
+        long long elapsed = bench_now_ns() - t0;
+        delete[] tids;
+
+        char param[32];
+        snprintf(param, sizeof(param), "threads=%d,pool=%d", n, SQL_POOL_SIZE);
+        bench_report("sql_pool_checkout", param, arg.ops * n, elapsed);
+    }
+}
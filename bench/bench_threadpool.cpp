@@ -0,0 +1,98 @@
+#include <sched.h>
+#include <unistd.h>
+#include "bench.h"
+#include "../threadpool/threadpool.h"
+
+//满足threadpool对任务类型要求的空任务
+struct bench_task
+{
+    int m_state;
+    int improv;
+    int timer_flag;
+    long long m_enqueue_ns;
+    MYSQL *mysql;
+
+    int get_sockfd() { return -1; }
+    bool read_once() { return true; }
+    bool write() { return true; }
+    bool pipelined() { return false; }
+    void enter_worker() {}
+    void leave_worker() {}
+    void process_db() {}
+    void process()
+    {
+        if (block_us)
+            usleep(block_us);
+        __sync_fetch_and_add(&done, 1);
+    }
+
+    static long long done;
+    static int block_us;    //模拟等待数据库等阻塞操作
+};
+
+long long bench_task::done = 0;
+int bench_task::block_us = 0;
+
+void bench_threadpool()
+{
+    if (!bench_enabled("threadpool"))
+        return;
+
+    static const int threads[] = {1, 4, 8};
+    //未初始化的连接池,只有数据库执行器会取连接,取到NULL
+    connection_pool *pool = connection_pool::GetInstance();
+    Metrics::get_instance()->init(false, "/metrics");
+
+    for (size_t t = 0; t < sizeof(threads) / sizeof(threads[0]); ++t)
+    {
+        //线程池没有退出机制,每个规模各创建一次
+        threadpool<bench_task> *tp = new threadpool<bench_task>(0, pool, threads[t], 10000);
+        long long ops = 1000000 * g_bench.scale;
+        bench_task task;
+        task.mysql = NULL;
+        bench_task::done = 0;
+
+        long long t0 = bench_now_ns();
+        for (long long i = 0; i < ops; ++i)
+        {
+            //队列满时让出CPU等待消费
+            while (!tp->append_p(&task))
+                sched_yield();
+        }
+        while (__sync_fetch_and_add(&bench_task::done, 0) < ops)
+            sched_yield();
+        long long elapsed = bench_now_ns() - t0;
+
+        char param[32];
+        snprintf(param, sizeof(param), "threads=%d", threads[t]);
+        bench_report("threadpool_enqueue_dequeue", param, ops, elapsed);
+    }
+
+    //阻塞任务:固定2个线程与2~32个线程动态伸缩对比,每批投入64个任务后等待完成
+    bench_task::block_us = 200;
+    for (int dynamic = 0; dynamic < 2; ++dynamic)
+    {
+        threadpool<bench_task> *tp = new threadpool<bench_task>(0, pool, 2, 10000);
+        if (dynamic)
+            tp->dynamic(2, 32, 500, 1000);
+        long long batches = 200 * g_bench.scale;
+        bench_task task;
+        task.mysql = NULL;
+        bench_task::done = 0;
+
+        long long t0 = bench_now_ns();
+        for (long long b = 0; b < batches; ++b)
+        {
+            for (int i = 0; i < 64; ++i)
+                tp->append_p(&task);
+            while (__sync_fetch_and_add(&bench_task::done, 0) < (b + 1) * 64)
+                usleep(50);
+        }
+        long long elapsed = bench_now_ns() - t0;
+
+        char param[48];
+        snprintf(param, sizeof(param), "%s,block_us=200,threads=%d", dynamic ? "dynamic" : "fixed", tp->threads());
+        bench_report("threadpool_blocking", param, batches * 64, elapsed);
+    }
+    bench_task::block_us = 0;
+}
@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include "bench.h"
+#include "../timer/lst_timer.h"
+
+static long long g_fired = 0;
+
+static void noop_cb(client_data *)
+{
+    g_fired++;
+}
+
+static util_timer *new_timer(time_t expire, client_data *data)
+{
+    util_timer *t = new util_timer;
+    t->expire = expire;
+    t->cb_func = noop_cb;
+    t->user_data = data;
+    return t;
+}
+
+//按到期时间递减的顺序插入,每次都插在表头,预填充为O(n)
+static void prefill(sort_timer_lst &lst, util_timer **timers, int n, time_t base, client_data *data)
+{
+    for (int i = n - 1; i >= 0; --i)
+    {
+        timers[i] = new_timer(base + i, data);
+        lst.add_timer(timers[i]);
+    }
+}
+
+void bench_timer()
+{
+    static const int sizes[] = {1000, 10000, 100000, 1000000};
+    client_data data;
+    data.sockfd = -1;
+    data.timer = NULL;
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s)
+    {
+        int n = sizes[s];
+        char param[32];
+        snprintf(param, sizeof(param), "n=%d", n);
+        //链表操作是O(n)的,规模越大次数越少,保证每项耗时可控
+        long long ops = 20000000LL / n * g_bench.scale;
+        if (ops < 20)
+            ops = 20;
+        time_t base = time(NULL) + 1000000;
+
+        //新连接的定时器总是最晚到期,需要走到表尾;随后删除以保持规模为n
+        if (bench_enabled("timer_add"))
+        {
+            sort_timer_lst lst;
+            util_timer **timers = new util_timer *[n];
+            prefill(lst, timers, n, base, &data);
+            long long t0 = bench_now_ns();
+            for (long long i = 0; i < ops; ++i)
+            {
+                util_timer *t = new_timer(base + n + i, &data);
+                lst.add_timer(t);
+                lst.del_timer(t);
+            }
+            bench_report("timer_add", param, ops, bench_now_ns() - t0);
+            delete[] timers;
+        }
+
+        //有数据到达的连接延后到期时间,从表头附近移动到表尾
+        if (bench_enabled("timer_adjust"))
+        {
+            sort_timer_lst lst;
+            util_timer **timers = new util_timer *[n];
+            prefill(lst, timers, n, base, &data);
+            time_t expire = base + n;
+            long long t0 = bench_now_ns();
+            for (long long i = 0; i < ops; ++i)
+            {
+                util_timer *t = timers[i % n];
+                t->expire = expire++;
+                lst.adjust_timer(t);
+            }
+            bench_report("timer_adjust", param, ops, bench_now_ns() - t0);
+            delete[] timers;
+        }
+
+        //n个定时器全部到期,统计每个定时器的处理开销
+        if (bench_enabled("timer_tick"))
+        {
+            sort_timer_lst lst;
+            util_timer **timers = new util_timer *[n];
+            prefill(lst, timers, n, 0, &data);
+            g_fired = 0;
+            long long t0 = bench_now_ns();
+            lst.tick();
+            long long elapsed = bench_now_ns() - t0;
+            bench_report("timer_tick", param, g_fired, elapsed);
+            delete[] timers;
+        }
+    }
+}
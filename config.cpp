@@ -1,4 +1,36 @@
 #include "config.h"
+#include <getopt.h>
+
+//只有长选项的参数
+enum
+{
+    OPT_ACCESS_LOG = 256,
+    OPT_ACCESS_LOG_FIELDS,
+    OPT_METRICS,
+    OPT_COMPRESS_CACHE,
+    OPT_IO_URING,
+    OPT_EPOLL_ONESHOT,
+    OPT_BACKLOG,
+    OPT_ACCEPT_BATCH,
+    OPT_DEFER_ACCEPT,
+    OPT_FASTOPEN,
+    OPT_NODELAY,
+    OPT_SNDBUF,
+    OPT_RCVBUF,
+    OPT_NOTSENT_LOWAT,
+    OPT_LISTEN,
+    OPT_NUMA_NODE,
+    OPT_LOOP_CPUS,
+    OPT_WORKER_CPUS,
+    OPT_INCOMING_CPU,
+    OPT_THREADS_MIN,
+    OPT_THREADS_MAX,
+    OPT_POOL_GROW_WAIT,
+    OPT_POOL_IDLE,
+    OPT_DB_THREADS,
+    OPT_UPGRADE_SOCK,
+    OPT_DRAIN_TIMEOUT
+};
 
 Config::Config(){
     //端口号,默认9006
@@ -25,17 +57,87 @@ Config::Config(){
     //线程池内的线程数量,默认8
     thread_num = 8;
 
+    //数据库执行器线程数,默认与数据库连接数相同
+    db_threads = 0;
+
+    //线程池伸缩,默认固定
+    threads_min = 0;
+    threads_max = 0;
+    pool_grow_wait = 2000;
+    pool_idle = 10000;
+
     //关闭日志,默认不关闭
     close_log = 0;
 
     //并发模型,默认是proactor
     actor_model = 0;
+
+    //访问日志,默认关闭
+    access_log_sample = 0;
+
+    //访问日志字段,默认全部输出
+    access_log_fields = "method,path,status,bytes,latency_us,client,reuse";
+
+    //监控地址,默认关闭
+    metrics = 0;
+
+    //压缩缓存,默认关闭
+    compress_cache = 0;
+
+    //I/O后端,默认epoll
+    io_uring = 0;
+
+    //epoll重新注册方式,默认EPOLLONESHOT
+    epoll_oneshot = 1;
+
+    //监听队列长度,受net.core.somaxconn限制
+    backlog = 1024;
+
+    //每轮事件循环最多accept的连接数
+    accept_batch = 64;
+
+    //socket选项,默认都不设置,使用系统默认值
+    memset(&sock_opt, 0, sizeof(sock_opt));
+
+    //CPU与NUMA节点,默认由调度器决定
+    numa_node = -1;
+
+    //热升级,默认不启用;退出时最多等待已有连接30秒
+    drain_timeout = 30;
 }
 
 void Config::parse_arg(int argc, char*argv[]){
     int opt;
     const char *str = "p:l:m:o:s:t:c:a:";
-    while ((opt = getopt(argc, argv, str)) != -1)
+    static struct option long_opts[] = {
+        {"access-log", required_argument, NULL, OPT_ACCESS_LOG},
+        {"access-log-fields", required_argument, NULL, OPT_ACCESS_LOG_FIELDS},
+        {"metrics", required_argument, NULL, OPT_METRICS},
+        {"compress-cache", required_argument, NULL, OPT_COMPRESS_CACHE},
+        {"io-uring", required_argument, NULL, OPT_IO_URING},
+        {"epoll-oneshot", required_argument, NULL, OPT_EPOLL_ONESHOT},
+        {"backlog", required_argument, NULL, OPT_BACKLOG},
+        {"accept-batch", required_argument, NULL, OPT_ACCEPT_BATCH},
+        {"defer-accept", required_argument, NULL, OPT_DEFER_ACCEPT},
+        {"fastopen", required_argument, NULL, OPT_FASTOPEN},
+        {"nodelay", required_argument, NULL, OPT_NODELAY},
+        {"sndbuf", required_argument, NULL, OPT_SNDBUF},
+        {"rcvbuf", required_argument, NULL, OPT_RCVBUF},
+        {"notsent-lowat", required_argument, NULL, OPT_NOTSENT_LOWAT},
+        {"listen", required_argument, NULL, OPT_LISTEN},
+        {"numa-node", required_argument, NULL, OPT_NUMA_NODE},
+        {"loop-cpus", required_argument, NULL, OPT_LOOP_CPUS},
+        {"worker-cpus", required_argument, NULL, OPT_WORKER_CPUS},
+        {"incoming-cpu", required_argument, NULL, OPT_INCOMING_CPU},
+        {"threads-min", required_argument, NULL, OPT_THREADS_MIN},
+        {"threads-max", required_argument, NULL, OPT_THREADS_MAX},
+        {"pool-grow-wait", required_argument, NULL, OPT_POOL_GROW_WAIT},
+        {"pool-idle", required_argument, NULL, OPT_POOL_IDLE},
+        {"db-threads", required_argument, NULL, OPT_DB_THREADS},
+        {"upgrade-sock", required_argument, NULL, OPT_UPGRADE_SOCK},
+        {"drain-timeout", required_argument, NULL, OPT_DRAIN_TIMEOUT},
+        {NULL, 0, NULL, 0}};
+    while ((opt = getopt_long(argc, argv, str, long_opts, NULL)) != -1)
     {
         switch (opt)
         {
@@ -79,6 +181,136 @@ void Config::parse_arg(int argc, char*argv[]){
             actor_model = atoi(optarg);
             break;
         }
+        case OPT_ACCESS_LOG:
+        {
+            access_log_sample = atoi(optarg);
+            break;
+        }
+        case OPT_ACCESS_LOG_FIELDS:
+        {
+            access_log_fields = optarg;
+            break;
+        }
+        case OPT_METRICS:
+        {
+            metrics = atoi(optarg);
+            break;
+        }
+        case OPT_COMPRESS_CACHE:
+        {
+            compress_cache = atoi(optarg);
+            break;
+        }
+        case OPT_IO_URING:
+        {
+            io_uring = atoi(optarg);
+            break;
+        }
+        case OPT_EPOLL_ONESHOT:
+        {
+            epoll_oneshot = atoi(optarg);
+            break;
+        }
+        case OPT_BACKLOG:
+        {
+            backlog = atoi(optarg);
+            break;
+        }
+        case OPT_ACCEPT_BATCH:
+        {
+            accept_batch = atoi(optarg);
+            break;
+        }
+        case OPT_DEFER_ACCEPT:
+        {
+            sock_opt.defer_accept = atoi(optarg);
+            break;
+        }
+        case OPT_FASTOPEN:
+        {
+            sock_opt.fastopen = atoi(optarg);
+            break;
+        }
+        case OPT_NODELAY:
+        {
+            sock_opt.nodelay = atoi(optarg);
+            break;
+        }
+        case OPT_SNDBUF:
+        {
+            sock_opt.sndbuf = atoi(optarg);
+            break;
+        }
+        case OPT_RCVBUF:
+        {
+            sock_opt.rcvbuf = atoi(optarg);
+            break;
+        }
+        case OPT_NOTSENT_LOWAT:
+        {
+            sock_opt.notsent_lowat = atoi(optarg);
+            break;
+        }
+        case OPT_LISTEN:
+        {
+            listen_addrs.push_back(optarg);
+            break;
+        }
+        case OPT_NUMA_NODE:
+        {
+            numa_node = atoi(optarg);
+            break;
+        }
+        case OPT_LOOP_CPUS:
+        {
+            loop_cpus = optarg;
+            break;
+        }
+        case OPT_WORKER_CPUS:
+        {
+            worker_cpus = optarg;
+            break;
+        }
+        case OPT_INCOMING_CPU:
+        {
+            sock_opt.incoming_cpu = atoi(optarg);
+            break;
+        }
+        case OPT_THREADS_MIN:
+        {
+            threads_min = atoi(optarg);
+            break;
+        }
+        case OPT_THREADS_MAX:
+        {
+            threads_max = atoi(optarg);
+            break;
+        }
+        case OPT_POOL_GROW_WAIT:
+        {
+            pool_grow_wait = atoi(optarg);
+            break;
+        }
+        case OPT_POOL_IDLE:
+        {
+            pool_idle = atoi(optarg);
+            break;
+        }
+        case OPT_DB_THREADS:
+        {
+            db_threads = atoi(optarg);
+            break;
+        }
+        case OPT_UPGRADE_SOCK:
+        {
+            upgrade_sock = optarg;
+            break;
+        }
+        case OPT_DRAIN_TIMEOUT:
+        {
+            drain_timeout = atoi(optarg);
+            break;
+        }
         default:
             break;
         }
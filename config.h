@@ -37,11 +37,67 @@ public:
     //线程池内的线程数量
     int thread_num;
 
+    //数据库执行器线程数,0表示与sql_num相同
+    int db_threads;
+
+    //线程池伸缩的上下限,上限不大于下限时线程数固定为thread_num
+    int threads_min;
+    int threads_max;
+
+    //排队超过该时间(微秒)且没有空闲线程时加线程
+    int pool_grow_wait;
+
+    //线程空闲该时间(毫秒)后退出
+    int pool_idle;
+
     //是否关闭日志
     int close_log;
 
     //并发模型选择
     int actor_model;
+
+    //访问日志采样间隔,0表示关闭
+    int access_log_sample;
+
+    //访问日志字段
+    string access_log_fields;
+
+    //是否开启/metrics监控地址
+    int metrics;
+
+    //压缩缓存大小(MB),0表示关闭
+    int compress_cache;
+
+    //是否使用io_uring事件循环,不支持时退回epoll
+    int io_uring;
+
+    //epoll是否使用EPOLLONESHOT,0表示只注册一次,在用户态记录关注的事件
+    int epoll_oneshot;
+
+    //listen()的backlog
+    int backlog;
+
+    //每轮事件循环最多accept的连接数,LT和ET相同
+    int accept_batch;
+
+    //监听socket选项,0表示不设置
+    sock_options sock_opt;
+
+    //监听地址,可指定多个,为空时监听-p端口
+    vector<string> listen_addrs;
+
+    //NUMA节点,-1表示不指定
+    int numa_node;
+
+    //事件循环和工作线程的CPU列表,如"0-3,8",为空时不绑定(指定NUMA节点时取节点的CPU)
+    string loop_cpus;
+    string worker_cpus;
+
+    //热升级的unix socket路径,为空时不启用
+    string upgrade_sock;
+
+    //停止accept后等待已有连接的最长时间(秒)
+    int drain_timeout;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,131 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include "body_buffer.h"
+
+static bool write_all(int fd, const char *data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = write(fd, data, len);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+//临时文件没有名字,关闭后自动删除
+static int open_tmpfile()
+{
+    int fd = open(P_tmpdir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    if (fd >= 0)
+        return fd;
+    char path[] = P_tmpdir "/tws_body_XXXXXX";
+    fd = mkstemp(path);
+    if (fd >= 0)
+        unlink(path);
+    return fd;
+}
+
+bool body_buffer::spill()
+{
+    m_fd = open_tmpfile();
+    if (m_fd < 0)
+        return false;
+    //全部写入后再释放内存块,写失败时内存块保持原样,由clear()释放
+    for (size_t i = 0; i < m_blocks.size(); ++i)
+    {
+        if (!write_all(m_fd, m_blocks[i].data, m_blocks[i].len))
+        {
+            close(m_fd);
+            m_fd = -1;
+            return false;
+        }
+    }
+    for (size_t i = 0; i < m_blocks.size(); ++i)
+        free(m_blocks[i].data);
+    m_blocks.clear();
+    m_linear.clear();
+    return true;
+}
+
+bool body_buffer::append(const char *data, size_t len)
+{
+    if (len == 0)
+        return true;
+    if (m_fd < 0 && m_size + len > MEMORY_LIMIT && !spill())
+        return false;
+    m_size += len;
+    if (m_fd >= 0)
+        return write_all(m_fd, data, len);
+
+    while (len > 0)
+    {
+        //块大小从MIN_BLOCK开始倍增,留一个字节给c_str的结尾
+        if (m_blocks.empty() || m_blocks.back().len + 1 >= m_blocks.back().cap)
+        {
+            size_t cap = m_blocks.empty() ? MIN_BLOCK : m_blocks.back().cap * 2;
+            if (cap > MAX_BLOCK)
+                cap = MAX_BLOCK;
+            while (m_blocks.empty() && cap < len + 1 && cap < MAX_BLOCK)
+                cap *= 2;
+            block b;
+            b.data = (char *)malloc(cap);
+            if (!b.data)
+                return false;
+            b.len = 0;
+            b.cap = cap;
+            m_blocks.push_back(b);
+        }
+        block &b = m_blocks.back();
+        size_t n = b.cap - 1 - b.len;
+        if (n > len)
+            n = len;
+        memcpy(b.data + b.len, data, n);
+        b.len += n;
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+const char *body_buffer::c_str()
+{
+    if (m_fd >= 0)
+        return NULL;
+    if (m_blocks.empty())
+        return "";
+    if (m_blocks.size() == 1)
+    {
+        m_blocks[0].data[m_blocks[0].len] = '\0';
+        return m_blocks[0].data;
+    }
+    m_linear.clear();
+    m_linear.reserve(m_size);
+    for (size_t i = 0; i < m_blocks.size(); ++i)
+        m_linear.append(m_blocks[i].data, m_blocks[i].len);
+    return m_linear.c_str();
+}
+
+void body_buffer::clear()
+{
+    for (size_t i = 0; i < m_blocks.size(); ++i)
+        free(m_blocks[i].data);
+    m_blocks.clear();
+    if (m_fd >= 0)
+    {
+        close(m_fd);
+        m_fd = -1;
+    }
+    m_size = 0;
+    string().swap(m_linear);
+}
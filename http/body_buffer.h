@@ -0,0 +1,52 @@
+#ifndef BODY_BUFFER_H
+#define BODY_BUFFER_H
+
+#include <stddef.h>
+#include <vector>
+#include <string>
+
+using namespace std;
+
+//请求体缓冲
+//数据先放在按需分配的内存块中,小请求体只占用与其大小相当的内存;
+//超过内存上限后整体转存到临时文件,之后直接追加写文件
+class body_buffer
+{
+public:
+    static const size_t MIN_BLOCK = 256;
+    static const size_t MAX_BLOCK = 16 * 1024;
+    static const size_t MEMORY_LIMIT = 64 * 1024;
+
+    body_buffer() : m_size(0), m_fd(-1) {}
+    ~body_buffer() { clear(); }
+
+    //写临时文件或分配内存失败时返回false
+    bool append(const char *data, size_t len);
+    size_t size() const { return m_size; }
+
+    //请求体在内存中时返回以'\0'结尾的连续内容,在临时文件中时返回NULL
+    const char *c_str();
+
+    //临时文件描述符,请求体在内存中时为-1
+    int fd() const { return m_fd; }
+
+    //释放内存块并关闭临时文件
+    void clear();
+
+private:
+    bool spill();
+
+private:
+    struct block
+    {
+        char *data;
+        size_t len;
+        size_t cap;
+    };
+    vector<block> m_blocks;
+    size_t m_size;
+    int m_fd;
+    string m_linear; //多个内存块时拼接的结果
+};
+
+#endif
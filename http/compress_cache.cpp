@@ -0,0 +1,191 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#ifdef USE_ZLIB
+#include <zlib.h>
+#endif
+#include "compress_cache.h"
+
+CompressCache::CompressCache()
+{
+    m_max_bytes = 0;
+    m_queue = NULL;
+    m_bytes = 0;
+    m_entry_count = 0;
+}
+
+bool CompressCache::init(long long max_bytes, int max_queue_size)
+{
+#ifdef USE_ZLIB
+    if (max_bytes <= 0)
+        return true;
+    m_queue = new block_queue<task>(max_queue_size);
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, compress_thread, NULL) != 0)
+        return false;
+    pthread_detach(tid);
+    m_max_bytes = max_bytes;
+    return true;
+#else
+    (void)max_queue_size;
+    return max_bytes <= 0;
+#endif
+}
+
+bool CompressCache::compressible(const mime_type *mime, off_t size)
+{
+    return mime && mime->compressible && size >= MIN_SIZE && size <= MAX_SIZE;
+}
+
+static bool same_file(const file_meta &a, const file_meta &b)
+{
+    return a.dev == b.dev && a.ino == b.ino && a.size == b.size && a.mtime == b.mtime;
+}
+
+shared_ptr<const string> CompressCache::get(const char *path, const file_meta &meta)
+{
+    shared_ptr<const string> data;
+    m_lock.lock();
+    map<string, entry>::iterator it = m_entries.find(path);
+    if (it != m_entries.end() && same_file(it->second.meta, meta))
+    {
+        data = it->second.data;
+        m_lock.unlock();
+        return data;
+    }
+    if (m_pending.count(path))
+    {
+        m_lock.unlock();
+        return data;
+    }
+
+    //队列满时放弃,下次请求再提交
+    task t;
+    t.path = path;
+    t.meta = meta;
+    if (m_queue->push(t))
+        m_pending.insert(path);
+    m_lock.unlock();
+    return data;
+}
+
+void CompressCache::run()
+{
+    task t;
+    while (m_queue->pop(t))
+    {
+        shared_ptr<string> out(new string);
+        bool ok = compress(t.path.c_str(), t.meta, *out);
+        if (ok && (off_t)out->size() >= t.meta.size * 9 / 10)
+            out.reset();
+        if (ok)
+        {
+            store(t.path, t.meta, out);
+        }
+        else
+        {
+            m_lock.lock();
+            m_pending.erase(t.path);
+            m_lock.unlock();
+        }
+    }
+}
+
+//文件在提交后发生变化时放弃,由下次请求按新的元数据重新提交
+bool CompressCache::compress(const char *path, const file_meta &meta, string &out)
+{
+#ifdef USE_ZLIB
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_dev != meta.dev || st.st_ino != meta.ino ||
+        st.st_size != meta.size || st.st_mtime != meta.mtime)
+    {
+        close(fd);
+        return false;
+    }
+    string in(st.st_size, '\0');
+    off_t done = 0;
+    while (done < st.st_size)
+    {
+        ssize_t n = read(fd, &in[done], st.st_size - done);
+        if (n <= 0)
+            break;
+        done += n;
+    }
+    close(fd);
+    if (done != st.st_size)
+        return false;
+
+    //windowBits加16输出gzip格式
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return false;
+    out.resize(deflateBound(&zs, in.size()));
+    zs.next_in = (Bytef *)in.data();
+    zs.avail_in = in.size();
+    zs.next_out = (Bytef *)&out[0];
+    zs.avail_out = out.size();
+    int ret = deflate(&zs, Z_FINISH);
+    out.resize(zs.total_out);
+    deflateEnd(&zs);
+    return ret == Z_STREAM_END;
+#else
+    (void)path;
+    (void)meta;
+    (void)out;
+    return false;
+#endif
+}
+
+void CompressCache::store(const string &path, const file_meta &meta, shared_ptr<const string> data)
+{
+    long long size = data ? data->size() : 0;
+    if (size > m_max_bytes)
+    {
+        data.reset();
+        size = 0;
+    }
+
+    m_lock.lock();
+    m_pending.erase(path);
+    map<string, entry>::iterator it = m_entries.find(path);
+    if (it != m_entries.end())
+    {
+        if (it->second.data)
+            m_bytes -= it->second.data->size();
+    }
+    else
+    {
+        m_order.push_back(path);
+    }
+    //按插入顺序淘汰,正在发送的响应持有shared_ptr,淘汰后内存仍然有效
+    while (m_bytes + size > m_max_bytes && !m_order.empty())
+    {
+        string key = m_order.front();
+        m_order.pop_front();
+        if (key == path)
+        {
+            m_order.push_back(key);
+            continue;
+        }
+        map<string, entry>::iterator old = m_entries.find(key);
+        if (old != m_entries.end())
+        {
+            if (old->second.data)
+                m_bytes -= old->second.data->size();
+            m_entries.erase(old);
+        }
+    }
+    entry &e = m_entries[path];
+    e.meta = meta;
+    e.data = data;
+    m_bytes += size;
+    m_entry_count = m_entries.size();
+    m_lock.unlock();
+}
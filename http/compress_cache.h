@@ -0,0 +1,78 @@
+#ifndef COMPRESS_CACHE_H
+#define COMPRESS_CACHE_H
+
+#include <sys/types.h>
+#include <map>
+#include <deque>
+#include <set>
+#include <string>
+#include <memory>
+#include "../lock/locker.h"
+#include "../log/block_queue.h"
+#include "file_cache.h"
+
+using namespace std;
+
+//gzip压缩结果缓存
+//工作线程只查表,未命中时把文件交给后台线程压缩,本次仍返回原始内容
+class CompressCache
+{
+public:
+    static const off_t MIN_SIZE = 256;           //太小的文件压缩收益不如头部开销
+    static const off_t MAX_SIZE = 4 * 1024 * 1024;
+
+    static CompressCache *get_instance()
+    {
+        static CompressCache instance;
+        return &instance;
+    }
+
+    static void *compress_thread(void *)
+    {
+        CompressCache::get_instance()->run();
+        return NULL;
+    }
+
+    //max_bytes为缓存上限;未编译zlib(make ZLIB=1)时返回false
+    bool init(long long max_bytes, int max_queue_size = 1024);
+    bool enabled() { return m_max_bytes > 0; }
+
+    //按类型和大小判断是否值得压缩
+    static bool compressible(const mime_type *mime, off_t size);
+
+    //meta需与缓存中的一致,文件变化后视为未命中并重新压缩
+    shared_ptr<const string> get(const char *path, const file_meta &meta);
+
+    long long bytes() { return m_bytes; }
+    long long entries() { return m_entry_count; }
+
+private:
+    CompressCache();
+    ~CompressCache() {}
+    void run();
+    bool compress(const char *path, const file_meta &meta, string &out);
+    void store(const string &path, const file_meta &meta, shared_ptr<const string> data);
+
+private:
+    struct task
+    {
+        string path;
+        file_meta meta;
+    };
+    struct entry
+    {
+        file_meta meta;
+        shared_ptr<const string> data; //为空表示压缩后不够小,不再尝试
+    };
+
+    long long m_max_bytes;
+    locker m_lock;
+    map<string, entry> m_entries;
+    deque<string> m_order;  //插入顺序,超出上限时从最早的开始淘汰
+    set<string> m_pending;  //已提交尚未完成,避免重复压缩
+    block_queue<task> *m_queue;
+    long long m_bytes;
+    long long m_entry_count;
+};
+
+#endif
@@ -0,0 +1,73 @@
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include "file_cache.h"
+#include "compress_cache.h"
+
+void http_date(time_t t, char *buf, size_t len)
+{
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    strftime(buf, len, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+}
+
+time_t parse_http_date(const char *text)
+{
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    const char *end = strptime(text, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    if (!end || *end != '\0')
+        return -1;
+    return timegm(&tm);
+}
+
+void FileCache::fill(const char *path, const struct stat &st, file_meta &meta)
+{
+    meta.dev = st.st_dev;
+    meta.ino = st.st_ino;
+    meta.size = st.st_size;
+    meta.mtime = st.st_mtime;
+    snprintf(meta.etag, sizeof(meta.etag), "\"%llx-%llx-%llx\"",
+             (unsigned long long)st.st_ino, (unsigned long long)st.st_size, (unsigned long long)st.st_mtime);
+    http_date(st.st_mtime, meta.last_modified, sizeof(meta.last_modified));
+
+    const mime_type *mime = mime_of_path(path);
+    meta.content_type = mime ? mime->type : MIME_DEFAULT;
+
+    meta.encodings = 0;
+    char sibling[PATH_MAX];
+    struct stat sst;
+    snprintf(sibling, sizeof(sibling), "%s.gz", path);
+    if (stat(sibling, &sst) == 0 && S_ISREG(sst.st_mode))
+        meta.encodings |= ENC_GZIP_FILE;
+    snprintf(sibling, sizeof(sibling), "%s.br", path);
+    if (stat(sibling, &sst) == 0 && S_ISREG(sst.st_mode))
+        meta.encodings |= ENC_BR_FILE;
+    if (CompressCache::get_instance()->enabled() && CompressCache::compressible(mime, st.st_size))
+        meta.encodings |= ENC_COMPRESSIBLE;
+}
+
+void FileCache::lookup(const char *path, const struct stat &st, file_meta &meta)
+{
+    m_lock.lock();
+    map<string, file_meta>::iterator it = m_entries.find(path);
+    if (it != m_entries.end() && it->second.dev == st.st_dev && it->second.ino == st.st_ino &&
+        it->second.size == st.st_size && it->second.mtime == st.st_mtime)
+    {
+        meta = it->second;
+        ++m_hits;
+        m_lock.unlock();
+        return;
+    }
+    ++m_misses;
+    m_lock.unlock();
+
+    //计算不需要持锁
+    fill(path, st, meta);
+
+    m_lock.lock();
+    if ((int)m_entries.size() >= MAX_ENTRIES)
+        m_entries.clear();
+    m_entries[path] = meta;
+    m_lock.unlock();
+}
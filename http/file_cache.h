@@ -0,0 +1,70 @@
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <sys/stat.h>
+#include <time.h>
+#include <map>
+#include <string>
+#include "../lock/locker.h"
+#include "mime.h"
+
+using namespace std;
+
+//file_meta::encodings的取值
+enum
+{
+    ENC_GZIP_FILE = 1,   //存在.gz预压缩文件
+    ENC_BR_FILE = 2,     //存在.br预压缩文件
+    ENC_COMPRESSIBLE = 4 //可由压缩缓存生成gzip
+};
+
+//文件元数据,只在文件首次访问或发生变化时计算
+struct file_meta
+{
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    time_t mtime;
+    char etag[64];          //"inode-size-mtime",带引号
+    char last_modified[32]; //RFC 7231格式的修改时间
+    int encodings;          //可用的压缩形式,非0时响应带Vary
+    const char *content_type; //指向mime_types中的常量
+};
+
+class FileCache
+{
+public:
+    static const int MAX_ENTRIES = 4096; //超过后整体清空,避免无限增长
+
+    static FileCache *get_instance()
+    {
+        static FileCache instance;
+        return &instance;
+    }
+
+    //st为本次stat的结果,inode、大小或修改时间变化时重新计算
+    //预压缩文件只在原文件变化时重新检查,单独更新.gz/.br后需同时touch原文件
+    void lookup(const char *path, const struct stat &st, file_meta &meta);
+
+    long long hits() { return m_hits; }
+    long long misses() { return m_misses; }
+
+private:
+    FileCache() : m_hits(0), m_misses(0) {}
+    ~FileCache() {}
+    static void fill(const char *path, const struct stat &st, file_meta &meta);
+
+private:
+    locker m_lock;
+    map<string, file_meta> m_entries;
+    long long m_hits;
+    long long m_misses;
+};
+
+//RFC 7231格式的时间,如Sun, 06 Nov 1994 08:49:37 GMT
+void http_date(time_t t, char *buf, size_t len);
+
+//解析RFC 7231格式的时间,失败返回-1
+time_t parse_http_date(const char *text);
+
+#endif
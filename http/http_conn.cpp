@@ -5,18 +5,61 @@
 
 //定义http响应的一些状态信息
 const char *ok_200_title = "OK";
+const char *partial_206_title = "Partial Content";
+const char *not_modified_304_title = "Not Modified";
 const char *error_400_title = "Bad Request";
 const char *error_400_form = "Your request has bad syntax or is inherently impossible to staisfy.\n";
 const char *error_403_title = "Forbidden";
 const char *error_403_form = "You do not have permission to get file form this server.\n";
 const char *error_404_title = "Not Found";
 const char *error_404_form = "The requested file was not found on this server.\n";
+const char *error_413_title = "Payload Too Large";
+const char *error_413_form = "The request body is larger than the server is willing to process.\n";
+const char *error_405_title = "Method Not Allowed";
+const char *error_405_form = "The request method is not supported by this server.\n";
+const char *error_416_title = "Range Not Satisfiable";
+const char *error_416_form = "The requested range is not satisfiable.\n";
 const char *error_500_title = "Internal Error";
 const char *error_500_form = "There was an unusual problem serving the request file.\n";
+const char *error_505_title = "HTTP Version Not Supported";
+const char *error_505_form = "Only HTTP/1.0 and HTTP/1.1 are supported.\n";
+
+//OPTIONS和405响应的Allow头部
+const char *allowed_methods = "GET, HEAD, POST, OPTIONS";
+
+//与METHOD枚举顺序一致
+static const char *method_names[] = {"GET", "POST", "HEAD", "PUT", "DELETE", "TRACE", "OPTIONS", "CONNECT", "PATH"};
 
 locker m_lock;
 map<string, string> users;
 
+//Accept-Encoding中是否接受name,q=0表示明确拒绝
+static bool accepts_encoding(const char *header, const char *name)
+{
+    size_t name_len = strlen(name);
+    const char *p = header;
+    while (*p)
+    {
+        p += strspn(p, " \t,");
+        size_t len = strcspn(p, " \t,;");
+        bool match = (len == name_len && strncasecmp(p, name, len) == 0) || (len == 1 && *p == '*');
+        const char *end = p + strcspn(p, ",");
+        double q = 1;
+        for (p += len; p < end; ++p)
+        {
+            if (*p == ';')
+            {
+                const char *param = p + 1 + strspn(p + 1, " \t");
+                if ((*param == 'q' || *param == 'Q') && param[1] == '=')
+                    q = atof(param + 2);
+            }
+        }
+        if (match && q > 0)
+            return true;
+    }
+    return false;
+}
+
 void http_conn::initmysql_result(connection_pool *connPool)
 {
     //先从连接池中取一个连接
@@ -57,10 +100,10 @@ int setnonblocking(int fd)
 }
 
 //将内核事件表注册读事件，ET模式，选择开启EPOLLONESHOT
-void addfd(int epollfd, int fd, bool one_shot, int TRIGMode)
+void addfd(int epollfd, int fd, uint64_t key, bool one_shot, int TRIGMode)
 {
     epoll_event event;
-    event.data.fd = fd;
+    event.data.u64 = key;
 
     if (1 == TRIGMode)
         event.events = EPOLLIN | EPOLLET | EPOLLRDHUP;
@@ -69,22 +112,24 @@ void addfd(int epollfd, int fd, bool one_shot, int TRIGMode)
 
     if (one_shot)
         event.events |= EPOLLONESHOT;
+    //accept4时已设为非阻塞
     epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event);
-    setnonblocking(fd);
+    metrics_add(Metrics::local()->epoll_ctls);
 }
 
 //从内核时间表删除描述符
 void removefd(int epollfd, int fd)
 {
     epoll_ctl(epollfd, EPOLL_CTL_DEL, fd, 0);
+    metrics_add(Metrics::local()->epoll_ctls);
     close(fd);
 }
 
 //将事件重置为EPOLLONESHOT
-void modfd(int epollfd, int fd, int ev, int TRIGMode)
+void modfd(int epollfd, int fd, uint64_t key, int ev, int TRIGMode)
 {
     epoll_event event;
-    event.data.fd = fd;
+    event.data.u64 = key;
 
     if (1 == TRIGMode)
         event.events = ev | EPOLLET | EPOLLONESHOT | EPOLLRDHUP;
@@ -92,31 +137,29 @@ void modfd(int epollfd, int fd, int ev, int TRIGMode)
         event.events = ev | EPOLLONESHOT | EPOLLRDHUP;
 
     epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &event);
+    metrics_add(Metrics::local()->epoll_ctls);
 }
 
 int http_conn::m_user_count = 0;
 int http_conn::m_epollfd = -1;
-
-//关闭连接，关闭一个连接，客户总量减一
-void http_conn::close_conn(bool real_close)
-{
-    if (real_close && (m_sockfd != -1))
-    {
-        printf("close %d\n", m_sockfd);
-        removefd(m_epollfd, m_sockfd);
-        m_sockfd = -1;
-        m_user_count--;
-    }
-}
+void (*http_conn::m_notify)(http_conn *conn, int ev) = NULL;
+bool (*http_conn::m_db_submit)(http_conn *conn) = NULL;
+bool http_conn::m_draining = false;
 
 //初始化连接,外部调用初始化套接字地址
-void http_conn::init(int sockfd, const sockaddr_in &addr, char *root, int TRIGMode,
+void http_conn::init(int sockfd, const sockaddr_storage &addr, char *root, int TRIGMode,
                      int close_log, string user, string passwd, string sqlname)
 {
     m_sockfd = sockfd;
     m_address = addr;
-
-    addfd(m_epollfd, sockfd, true, m_TRIGMode);
+    m_reuse = 0;
+    m_accept_ns = metrics_now_ns();
+    if (++m_gen == 0)
+        m_gen = 1;
+
+    //io_uring后端accept时已设为非阻塞,由事件循环提交读操作
+    if (!m_notify)
+        addfd(m_epollfd, sockfd, key(), true, m_TRIGMode);
     m_user_count++;
 
     //当浏览器出现连接重置时，可能是网站根目录出错或http响应格式出错或者访问的文件中内容完全为空
@@ -128,33 +171,68 @@ void http_conn::init(int sockfd, const sockaddr_in &addr, char *root, int TRIGMo
     strcpy(sql_passwd, passwd.c_str());
     strcpy(sql_name, sqlname.c_str());
 
+    m_read_idx = 0;
+    m_checked_idx = 0;
     init();
 }
 
 //初始化新接受的连接
 //check_state默认为分析请求行状态
+//[m_checked_idx, m_read_idx)是已读入的后续请求(pipeline),移到缓冲区开头继续处理
 void http_conn::init()
 {
+    int pending = m_read_idx - m_checked_idx;
+    if (pending > 0)
+        memmove(m_read_buf, m_read_buf + m_checked_idx, pending);
+    else
+        pending = 0;
+
     mysql = NULL;
     bytes_to_send = 0;
     bytes_have_send = 0;
     m_check_state = CHECK_STATE_REQUESTLINE;
     m_linger = false;
+    m_http10 = false;
+    m_header_len = 0;
     m_method = GET;
     m_url = 0;
     m_version = 0;
     m_content_length = 0;
+    m_chunked = false;
+    m_expect_continue = false;
+    m_chunk_state = CHUNK_SIZE;
+    m_chunk_left = 0;
+    m_body_start = 0;
+    m_string = 0;
+    m_body.clear();
     m_host = 0;
+    m_range = 0;
+    m_if_range = 0;
+    m_if_none_match = 0;
+    m_if_modified_since = 0;
+    m_accept_encoding = 0;
+    m_content_encoding = 0;
+    m_compressed.reset();
+    m_range_count = 0;
     m_start_line = 0;
     m_checked_idx = 0;
-    m_read_idx = 0;
+    m_read_idx = pending;
     m_write_idx = 0;
-    cgi = 0;
     m_state = 0;
     timer_flag = 0;
     improv = 0;
-
-    memset(m_read_buf, '\0', READ_BUFFER_SIZE);
+    m_status = 0;
+    m_start_ns = 0;
+    m_ready_ns = 0;
+    m_access_sampled = false;
+    release_body();
+    m_dyn_body.clear();
+    m_stream = NULL;
+    m_stream_ctx = NULL;
+    m_stream_cursor = 0;
+    m_stream_type = NULL;
+
+    memset(m_read_buf + pending, '\0', READ_BUFFER_SIZE - pending);
     memset(m_write_buf, '\0', WRITE_BUFFER_SIZE);
     memset(m_real_file, '\0', FILENAME_LEN);
 }
@@ -207,19 +285,22 @@ bool http_conn::read_once()
     if (0 == m_TRIGMode)
     {
         bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx, 0);
-        m_read_idx += bytes_read;
 
         if (bytes_read <= 0)
         {
             return false;
         }
+        if (m_read_idx == 0)
+            mark_request_start();
+        m_read_idx += bytes_read;
 
         return true;
     }
     //ET读数据
     else
     {
-        while (true)
+        //缓冲区满时先处理已读入的部分,请求体移出后重新注册读事件会再次触发
+        while (m_read_idx < READ_BUFFER_SIZE)
         {
             bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx, 0);
             if (bytes_read == -1)
@@ -232,6 +313,8 @@ bool http_conn::read_once()
             {
                 return false;
             }
+            if (m_read_idx == 0)
+                mark_request_start();
             m_read_idx += bytes_read;
         }
         return true;
@@ -248,23 +331,34 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char *text)
     }
     *m_url++ = '\0';
     char *method = text;
+    bool method_allowed = true;
     if (strcasecmp(method, "GET") == 0)
         m_method = GET;
     else if (strcasecmp(method, "POST") == 0)
-    {
         m_method = POST;
-        cgi = 1;
-    }
+    else if (strcasecmp(method, "HEAD") == 0)
+        m_method = HEAD;
+    else if (strcasecmp(method, "OPTIONS") == 0)
+        m_method = OPTIONS;
     else
-        return BAD_REQUEST;
+        method_allowed = false;
     m_url += strspn(m_url, " \t");
     m_version = strpbrk(m_url, " \t");
     if (!m_version)
         return BAD_REQUEST;
     *m_version++ = '\0';
     m_version += strspn(m_version, " \t");
-    if (strcasecmp(m_version, "HTTP/1.1") != 0)
+    //HTTP/1.1默认长连接,HTTP/1.0默认短连接,可由Connection头部改变
+    if (strcasecmp(m_version, "HTTP/1.1") == 0)
+        m_linger = true;
+    else if (strcasecmp(m_version, "HTTP/1.0") == 0)
+        m_http10 = true;
+    else if (strncasecmp(m_version, "HTTP/", 5) == 0 && m_version[5] >= '0' && m_version[5] <= '9')
+        return VERSION_NOT_SUPPORTED;
+    else
         return BAD_REQUEST;
+    if (!method_allowed)
+        return METHOD_NOT_ALLOWED;
     if (strncasecmp(m_url, "http://", 7) == 0)
     {
         m_url += 7;
@@ -277,11 +371,20 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char *text)
         m_url = strchr(m_url, '/');
     }
 
+    if (m_url && m_method == OPTIONS && strcmp(m_url, "*") == 0)
+    {
+        m_check_state = CHECK_STATE_HEADER;
+        return NO_REQUEST;
+    }
     if (!m_url || m_url[0] != '/')
         return BAD_REQUEST;
-    //当url为/时，显示判断界面
-    if (strlen(m_url) == 1)
-        strcat(m_url, "judge.html");
+    //采样命中时保存原始url,do_request会改写m_url
+    m_access_sampled = AccessLog::get_instance()->sampled();
+    if (m_access_sampled)
+    {
+        strncpy(m_access_path, m_url, FILENAME_LEN - 1);
+        m_access_path[FILENAME_LEN - 1] = '\0';
+    }
     m_check_state = CHECK_STATE_HEADER;
     return NO_REQUEST;
 }
@@ -291,9 +394,19 @@ http_conn::HTTP_CODE http_conn::parse_headers(char *text)
 {
     if (text[0] == '\0')
     {
-        if (m_content_length != 0)
+        if (m_content_length < 0)
+            return BAD_REQUEST;
+        if (m_content_length > MAX_BODY_SIZE)
+            return PAYLOAD_TOO_LARGE;
+        //同时出现时以Transfer-Encoding为准
+        if (m_chunked || m_content_length != 0)
         {
             m_check_state = CHECK_STATE_CONTENT;
+            m_body_start = m_checked_idx;
+            m_start_line = m_checked_idx;
+            //请求体还没有到达时才需要通知客户端继续发送
+            if (m_expect_continue && m_read_idx == m_checked_idx)
+                send_continue();
             return NO_REQUEST;
         }
         return GET_REQUEST;
@@ -302,7 +415,11 @@ http_conn::HTTP_CODE http_conn::parse_headers(char *text)
     {
         text += 11;
         text += strspn(text, " \t");
-        if (strcasecmp(text, "keep-alive") == 0)
+        if (strcasestr(text, "close"))
+        {
+            m_linger = false;
+        }
+        else if (strcasestr(text, "keep-alive"))
         {
             m_linger = true;
         }
@@ -311,7 +428,21 @@ http_conn::HTTP_CODE http_conn::parse_headers(char *text)
     {
         text += 15;
         text += strspn(text, " \t");
-        m_content_length = atol(text);
+        m_content_length = atoll(text);
+    }
+    else if (strncasecmp(text, "Transfer-Encoding:", 18) == 0)
+    {
+        text += 18;
+        text += strspn(text, " \t");
+        if (strcasestr(text, "chunked"))
+            m_chunked = true;
+    }
+    else if (strncasecmp(text, "Expect:", 7) == 0)
+    {
+        text += 7;
+        text += strspn(text, " \t");
+        if (strcasecmp(text, "100-continue") == 0 && !m_http10)
+            m_expect_continue = true;
     }
     else if (strncasecmp(text, "Host:", 5) == 0)
     {
@@ -319,6 +450,36 @@ http_conn::HTTP_CODE http_conn::parse_headers(char *text)
         text += strspn(text, " \t");
         m_host = text;
     }
+    else if (strncasecmp(text, "Range:", 6) == 0)
+    {
+        text += 6;
+        text += strspn(text, " \t");
+        m_range = text;
+    }
+    else if (strncasecmp(text, "If-Range:", 9) == 0)
+    {
+        text += 9;
+        text += strspn(text, " \t");
+        m_if_range = text;
+    }
+    else if (strncasecmp(text, "If-None-Match:", 14) == 0)
+    {
+        text += 14;
+        text += strspn(text, " \t");
+        m_if_none_match = text;
+    }
+    else if (strncasecmp(text, "If-Modified-Since:", 18) == 0)
+    {
+        text += 18;
+        text += strspn(text, " \t");
+        m_if_modified_since = text;
+    }
+    else if (strncasecmp(text, "Accept-Encoding:", 16) == 0)
+    {
+        text += 16;
+        text += strspn(text, " \t");
+        m_accept_encoding = text;
+    }
     else
     {
         LOG_INFO("oop!unknow header: %s", text);
@@ -326,17 +487,133 @@ http_conn::HTTP_CODE http_conn::parse_headers(char *text)
     return NO_REQUEST;
 }
 
-//判断http请求是否被完整读入
-http_conn::HTTP_CODE http_conn::parse_content(char *text)
+//读取请求体,已到达的部分移入m_body,读缓冲区只需容纳头部和一小段请求体
+http_conn::HTTP_CODE http_conn::parse_content()
 {
-    if (m_read_idx >= (m_content_length + m_checked_idx))
+    HTTP_CODE ret = NO_REQUEST;
+    if (m_chunked)
+    {
+        ret = parse_chunked();
+    }
+    else
+    {
+        long long n = m_content_length - (long long)m_body.size();
+        if (n > m_read_idx - m_checked_idx)
+            n = m_read_idx - m_checked_idx;
+        if (!m_body.append(m_read_buf + m_checked_idx, n))
+            return INTERNAL_ERROR;
+        m_checked_idx += n;
+        m_start_line = m_checked_idx;
+        if ((long long)m_body.size() == m_content_length)
+            ret = GET_REQUEST;
+    }
+
+    if (ret == NO_REQUEST)
+    {
+        compact_body();
+    }
+    else if (ret == GET_REQUEST)
     {
-        text[m_content_length] = '\0';
         //POST请求中最后为输入的用户名和密码
-        m_string = text;
-        return GET_REQUEST;
+        m_content_length = m_body.size();
+        m_string = (char *)m_body.c_str();
+    }
+    return ret;
+}
+
+//chunked请求体: 十六进制大小[;扩展]CRLF 数据 CRLF ... 0 CRLF [trailer] CRLF
+http_conn::HTTP_CODE http_conn::parse_chunked()
+{
+    while (true)
+    {
+        switch (m_chunk_state)
+        {
+        case CHUNK_SIZE:
+        case CHUNK_DATA_END:
+        case CHUNK_TRAILER:
+        {
+            LINE_STATUS status = parse_line();
+            if (status == LINE_OPEN)
+                return NO_REQUEST;
+            if (status == LINE_BAD)
+                return BAD_REQUEST;
+            char *line = m_read_buf + m_start_line;
+            m_start_line = m_checked_idx;
+            if (m_chunk_state == CHUNK_DATA_END)
+            {
+                if (line[0] != '\0')
+                    return BAD_REQUEST;
+                m_chunk_state = CHUNK_SIZE;
+            }
+            else if (m_chunk_state == CHUNK_TRAILER)
+            {
+                //trailer中的头部不使用,空行表示请求结束
+                if (line[0] == '\0')
+                    return GET_REQUEST;
+            }
+            else
+            {
+                char *end;
+                long long size = strtoll(line, &end, 16);
+                if (end == line || size < 0 || (*end != '\0' && *end != ';' && *end != ' ' && *end != '\t'))
+                    return BAD_REQUEST;
+                if ((long long)m_body.size() + size > MAX_BODY_SIZE)
+                    return PAYLOAD_TOO_LARGE;
+                m_chunk_left = size;
+                m_chunk_state = size == 0 ? CHUNK_TRAILER : CHUNK_DATA;
+            }
+            break;
+        }
+        case CHUNK_DATA:
+        {
+            long long n = m_read_idx - m_checked_idx;
+            if (n == 0)
+                return NO_REQUEST;
+            if (n > m_chunk_left)
+                n = m_chunk_left;
+            if (!m_body.append(m_read_buf + m_checked_idx, n))
+                return INTERNAL_ERROR;
+            m_checked_idx += n;
+            m_start_line = m_checked_idx;
+            m_chunk_left -= n;
+            if (m_chunk_left == 0)
+                m_chunk_state = CHUNK_DATA_END;
+            break;
+        }
+        }
+    }
+}
+
+//已移入m_body的数据不再需要,把未处理的部分移到请求体起始位置
+//请求行和头部保持不动,m_url等指针仍然有效
+void http_conn::compact_body()
+{
+    int shift = m_start_line - m_body_start;
+    if (shift <= 0)
+        return;
+    memmove(m_read_buf + m_body_start, m_read_buf + m_start_line, m_read_idx - m_start_line);
+    m_read_idx -= shift;
+    m_checked_idx -= shift;
+    m_start_line = m_body_start;
+    memset(m_read_buf + m_read_idx, '\0', READ_BUFFER_SIZE - m_read_idx);
+}
+
+//Expect: 100-continue,发送失败时客户端会在超时后直接发送请求体
+void http_conn::send_continue()
+{
+    static const char response[] = "HTTP/1.1 100 Continue\r\n\r\n";
+    send(m_sockfd, response, sizeof(response) - 1, MSG_NOSIGNAL);
+}
+
+//收到请求首字节,连接上的第一个请求同时记录accept到首字节的耗时
+void http_conn::mark_request_start()
+{
+    m_start_ns = metrics_now_ns();
+    if (m_accept_ns)
+    {
+        Metrics::get_instance()->record_latency(PHASE_ACCEPT, m_accept_ns, m_start_ns);
+        m_accept_ns = 0;
     }
-    return NO_REQUEST;
 }
 
 http_conn::HTTP_CODE http_conn::process_read()
@@ -344,6 +621,7 @@ http_conn::HTTP_CODE http_conn::process_read()
     LINE_STATUS line_status = LINE_OK;
     HTTP_CODE ret = NO_REQUEST;
     char *text = 0;
+    long long parse_start = metrics_now_ns();
 
     while ((m_check_state == CHECK_STATE_CONTENT && line_status == LINE_OK) || ((line_status = parse_line()) == LINE_OK))
     {
@@ -355,26 +633,28 @@ http_conn::HTTP_CODE http_conn::process_read()
         case CHECK_STATE_REQUESTLINE:
         {
             ret = parse_request_line(text);
-            if (ret == BAD_REQUEST)
-                return BAD_REQUEST;
+            if (ret != NO_REQUEST)
+                return ret;
             break;
         }
         case CHECK_STATE_HEADER:
         {
             ret = parse_headers(text);
-            if (ret == BAD_REQUEST)
-                return BAD_REQUEST;
+            if (ret != NO_REQUEST && ret != GET_REQUEST)
+                return ret;
             else if (ret == GET_REQUEST)
             {
-                return do_request();
+                return dispatch_request(parse_start);
             }
             break;
         }
         case CHECK_STATE_CONTENT:
         {
-            ret = parse_content(text);
+            ret = parse_content();
             if (ret == GET_REQUEST)
-                return do_request();
+                return dispatch_request(parse_start);
+            if (ret != NO_REQUEST)
+                return ret;
             line_status = LINE_OPEN;
             break;
         }
@@ -382,122 +662,163 @@ http_conn::HTTP_CODE http_conn::process_read()
             return INTERNAL_ERROR;
         }
     }
+    if (line_status == LINE_BAD)
+        return BAD_REQUEST;
     return NO_REQUEST;
 }
 
+//解析完成,记录解析耗时和do_request耗时,数据库请求的耗时在process_db中统计
+http_conn::HTTP_CODE http_conn::dispatch_request(long long parse_start)
+{
+    long long t = metrics_now_ns();
+    Metrics::get_instance()->record_latency(PHASE_PARSE, parse_start, t);
+    TRACE_PARSE_DONE(m_sockfd, (int)m_method, m_url);
+    HTTP_CODE ret = do_request();
+    if (ret == DB_REQUEST)
+        return ret;
+    Metrics::get_instance()->record_latency(PHASE_DO_FILE, t, metrics_now_ns());
+    TRACE_DO_REQUEST(m_sockfd, (int)ret, 0);
+    return ret;
+}
+
+route_table<http_conn::route_handler> http_conn::m_routes;
+
+void http_conn::init_routes()
+{
+    const unsigned pages = (1 << GET) | (1 << HEAD) | (1 << POST);
+    //判断界面和各个页面表单提交的地址
+    m_routes.add(pages, "/", false, &http_conn::route_page, "/judge.html");
+    m_routes.add(pages, "/0", false, &http_conn::route_page, "/register.html");
+    m_routes.add(pages, "/1", false, &http_conn::route_page, "/log.html");
+    m_routes.add(pages, "/5", false, &http_conn::route_page, "/picture.html");
+    m_routes.add(pages, "/6", false, &http_conn::route_page, "/video.html");
+    m_routes.add(pages, "/7", false, &http_conn::route_page, "/fans.html");
+    //登录和注册表单提交到2CGISQL.cgi和3CGISQL.cgi
+    m_routes.add(1 << POST, "/2", true, &http_conn::route_login, NULL);
+    m_routes.add(1 << POST, "/3", true, &http_conn::route_register, NULL);
+    //保留的监控地址,优先于同名文件
+    if (Metrics::get_instance()->enabled())
+        m_routes.add((1 << GET) | (1 << HEAD), Metrics::get_instance()->path(), false, &http_conn::route_metrics, NULL);
+}
+
 http_conn::HTTP_CODE http_conn::do_request()
 {
-    strcpy(m_real_file, doc_root);
-    int len = strlen(doc_root);
-    //printf("m_url:%s\n", m_url);
-    const char *p = strrchr(m_url, '/');
+    if (m_method == OPTIONS)
+        return OPTIONS_REQUEST;
 
-    //处理cgi
-    if (cgi == 1 && (*(p + 1) == '2' || *(p + 1) == '3'))
-    {
+    const route_table<route_handler>::route *r = m_routes.match(m_method, m_url);
+    if (r)
+        return (this->*r->handler)(r->arg);
+    return serve_file(m_url);
+}
 
-        //根据标志判断是登录检测还是注册检测
-        char flag = m_url[1];
+http_conn::HTTP_CODE http_conn::route_page(const char *url)
+{
+    return serve_file(url);
+}
 
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/");
-        strcat(m_url_real, m_url + 2);
-        strncpy(m_real_file + len, m_url_real, FILENAME_LEN - len - 1);
-        free(m_url_real);
+//监控数据分段输出,作为/metrics的流式响应
+static bool metrics_stream(void *ctx, string &out, int &cursor)
+{
+    return ((Metrics *)ctx)->render_part(out, cursor);
+}
 
-        //将用户名和密码提取出来
-        //user=123&passwd=123
-        char name[100], password[100];
-        int i;
-        for (i = 5; m_string[i] != '&'; ++i)
-            name[i - 5] = m_string[i];
-        name[i - 5] = '\0';
+http_conn::HTTP_CODE http_conn::route_metrics(const char *)
+{
+    return stream_response(metrics_stream, Metrics::get_instance(), "text/plain; version=0.0.4");
+}
 
-        int j = 0;
-        for (i = i + 10; m_string[i] != '\0'; ++i, ++j)
-            password[j] = m_string[i];
-        password[j] = '\0';
+//动态内容在process_write中按段生成,各路由提供自己的生成函数、状态和Content-Type
+http_conn::HTTP_CODE http_conn::stream_response(stream_fn fn, void *ctx, const char *content_type)
+{
+    m_stream = fn;
+    m_stream_ctx = ctx;
+    m_stream_cursor = 0;
+    m_stream_type = content_type;
+    return DYNAMIC_REQUEST;
+}
 
-        if (*(p + 1) == '3')
-        {
-            //如果是注册，先检测数据库中是否有重名的
-            //没有重名的，进行增加数据
-            char *sql_insert = (char *)malloc(sizeof(char) * 200);
-            strcpy(sql_insert, "INSERT INTO user(username, passwd) VALUES(");
-            strcat(sql_insert, "'");
-            strcat(sql_insert, name);
-            strcat(sql_insert, "', '");
-            strcat(sql_insert, password);
-            strcat(sql_insert, "')");
-
-            if (users.find(name) == users.end())
-            {
-                m_lock.lock();
-                int res = mysql_query(mysql, sql_insert);
-                users.insert(pair<string, string>(name, password));
-                m_lock.unlock();
-
-                if (!res)
-                    strcpy(m_url, "/log.html");
-                else
-                    strcpy(m_url, "/registerError.html");
-            }
-            else
-                strcpy(m_url, "/registerError.html");
-        }
-        //如果是登录，直接判断
-        //若浏览器端输入的用户名和密码在表中可以查找到，返回1，否则返回0
-        else if (*(p + 1) == '2')
-        {
-            if (users.find(name) != users.end() && users[name] == password)
-                strcpy(m_url, "/welcome.html");
-            else
-                strcpy(m_url, "/logError.html");
-        }
-    }
+//将用户名和密码提取出来
+//user=123&password=123
+bool http_conn::parse_user(char *name, char *password)
+{
+    const char *sep = m_string ? strstr(m_string, "&password=") : NULL;
+    if (!sep || strncmp(m_string, "user=", 5) != 0 || sep - m_string - 5 >= 100 || strlen(sep + 10) >= 100)
+        return false;
+    int i;
+    for (i = 5; m_string[i] != '&'; ++i)
+        name[i - 5] = m_string[i];
+    name[i - 5] = '\0';
+
+    int j = 0;
+    for (i = i + 10; m_string[i] != '\0'; ++i, ++j)
+        password[j] = m_string[i];
+    password[j] = '\0';
+    return true;
+}
 
-    if (*(p + 1) == '0')
-    {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/register.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
+http_conn::HTTP_CODE http_conn::route_login(const char *)
+{
+    return defer_db(&http_conn::db_login);
+}
 
-        free(m_url_real);
-    }
-    else if (*(p + 1) == '1')
-    {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/log.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
+http_conn::HTTP_CODE http_conn::route_register(const char *)
+{
+    return defer_db(&http_conn::db_register);
+}
 
-        free(m_url_real);
-    }
-    else if (*(p + 1) == '5')
-    {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/picture.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
+//登录注册可能等待数据库连接和查询,交给数据库执行器,工作线程继续处理其他请求
+http_conn::HTTP_CODE http_conn::defer_db(route_handler handler)
+{
+    m_db_handler = handler;
+    return DB_REQUEST;
+}
 
-        free(m_url_real);
-    }
-    else if (*(p + 1) == '6')
-    {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/video.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
+//若浏览器端输入的用户名和密码在表中可以查找到，进入欢迎界面
+http_conn::HTTP_CODE http_conn::db_login(const char *)
+{
+    char name[100], password[100];
+    if (!parse_user(name, password))
+        return BAD_REQUEST;
 
-        free(m_url_real);
-    }
-    else if (*(p + 1) == '7')
-    {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/fans.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
+    m_lock.lock();
+    map<string, string>::iterator it = users.find(name);
+    bool ok = it != users.end() && it->second == password;
+    m_lock.unlock();
+    return serve_file(ok ? "/welcome.html" : "/logError.html");
+}
+
+//如果是注册，先检测数据库中是否有重名的
+//没有重名的，进行增加数据
+http_conn::HTTP_CODE http_conn::db_register(const char *)
+{
+    char name[100], password[100];
+    if (!parse_user(name, password))
+        return BAD_REQUEST;
 
-        free(m_url_real);
+    char sql_insert[256];
+    snprintf(sql_insert, sizeof(sql_insert), "INSERT INTO user(username, passwd) VALUES('%s', '%s')", name, password);
+    //检查和插入在同一把锁内,同名的并发注册只有一个成功
+    m_lock.lock();
+    if (users.find(name) != users.end())
+    {
+        m_lock.unlock();
+        return serve_file("/registerError.html");
     }
-    else
-        strncpy(m_real_file + len, m_url, FILENAME_LEN - len - 1);
+    int res = mysql_query(mysql, sql_insert);
+    if (!res)
+        users.insert(pair<string, string>(name, password));
+    m_lock.unlock();
+
+    return serve_file(res ? "/registerError.html" : "/log.html");
+}
+
+//url相对于doc_root
+http_conn::HTTP_CODE http_conn::serve_file(const char *url)
+{
+    int len = strlen(doc_root);
+    strcpy(m_real_file, doc_root);
+    strncpy(m_real_file + len, url, FILENAME_LEN - len - 1);
 
     if (stat(m_real_file, &m_file_stat) < 0)
         return NO_RESOURCE;
@@ -506,78 +827,377 @@ http_conn::HTTP_CODE http_conn::do_request()
         return FORBIDDEN_REQUEST;
 
     if (S_ISDIR(m_file_stat.st_mode))
-        return BAD_REQUEST;
+        return NO_RESOURCE;
 
-    int fd = open(m_real_file, O_RDONLY);
-    m_file_address = (char *)mmap(0, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
-    close(fd);
+    //元数据按文件缓存,文件变化后自动重新计算
+    FileCache::get_instance()->lookup(m_real_file, m_file_stat, m_meta);
+    select_encoding();
+    if ((m_method == GET || m_method == HEAD) && not_modified())
+        return NOT_MODIFIED;
+
+    //空文件没有可取的区间,直接返回整个文件
+    if (m_range && m_method == GET && m_file_stat.st_size > 0 && if_range_match())
+    {
+        if (!parse_range())
+            return RANGE_NOT_SATISFIABLE;
+    }
+
+    //HEAD只需要文件大小,不打开文件;压缩缓存的内容直接从内存发送
+    if (m_method == HEAD || m_compressed)
+        return FILE_REQUEST;
+
+    //文件保持打开到发送完毕,由sendfile从页缓存发送
+    m_file_fd = open(m_real_file, O_RDONLY);
+    if (m_file_fd < 0)
+        return INTERNAL_ERROR;
     return FILE_REQUEST;
 }
-void http_conn::unmap()
+
+//优先br、gzip预压缩文件,其次压缩缓存;选中后m_file_stat改为压缩内容的大小
+//不同编码是不同的表示,ETag加上编码后缀,Range也作用于压缩后的内容
+void http_conn::select_encoding()
 {
-    if (m_file_address)
+    if (!m_meta.encodings || !m_accept_encoding || (m_method != GET && m_method != HEAD))
+        return;
+
+    if ((m_meta.encodings & ENC_BR_FILE) && accepts_encoding(m_accept_encoding, "br") && use_sibling(".br"))
+        m_content_encoding = "br";
+    else if ((m_meta.encodings & ENC_GZIP_FILE) && accepts_encoding(m_accept_encoding, "gzip") && use_sibling(".gz"))
+        m_content_encoding = "gzip";
+    else if ((m_meta.encodings & ENC_COMPRESSIBLE) && accepts_encoding(m_accept_encoding, "gzip"))
     {
-        munmap(m_file_address, m_file_stat.st_size);
-        m_file_address = 0;
+        m_compressed = CompressCache::get_instance()->get(m_real_file, m_meta);
+        if (!m_compressed)
+            return;
+        m_file_stat.st_size = m_compressed->size();
+        m_content_encoding = "gzip";
     }
+    else
+        return;
+
+    size_t len = strlen(m_meta.etag);
+    snprintf(m_meta.etag + len - 1, sizeof(m_meta.etag) - len + 1, "-%s\"", m_content_encoding);
 }
-bool http_conn::write()
-{
-    int temp = 0;
 
-    if (bytes_to_send == 0)
+bool http_conn::use_sibling(const char *ext)
+{
+    size_t len = strlen(m_real_file);
+    if (len + strlen(ext) >= FILENAME_LEN)
+        return false;
+    struct stat st;
+    strcpy(m_real_file + len, ext);
+    if (stat(m_real_file, &st) < 0 || !S_ISREG(st.st_mode) || !(st.st_mode & S_IROTH))
     {
-        modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
-        init();
-        return true;
+        m_real_file[len] = '\0';
+        return false;
     }
+    m_file_stat = st;
+    return true;
+}
 
-    while (1)
+//If-None-Match按弱比较匹配ETag列表,存在时忽略If-Modified-Since
+bool http_conn::not_modified()
+{
+    if (m_if_none_match)
     {
-        temp = writev(m_sockfd, m_iv, m_iv_count);
-
-        if (temp < 0)
+        size_t etag_len = strlen(m_meta.etag);
+        const char *p = m_if_none_match;
+        while (*p)
         {
-            if (errno == EAGAIN)
-            {
-                modfd(m_epollfd, m_sockfd, EPOLLOUT, m_TRIGMode);
+            p += strspn(p, " \t,");
+            if (*p == '*')
                 return true;
-            }
-            unmap();
-            return false;
+            if (strncmp(p, "W/", 2) == 0)
+                p += 2;
+            size_t len = strcspn(p, " \t,");
+            if (len == etag_len && strncmp(p, m_meta.etag, len) == 0)
+                return true;
+            p += len;
         }
+        return false;
+    }
+    if (m_if_modified_since)
+    {
+        time_t t = parse_http_date(m_if_modified_since);
+        return t != -1 && m_meta.mtime <= t;
+    }
+    return false;
+}
+
+//If-Range为ETag时强比较,为时间时与Last-Modified一致才有效
+//不匹配说明文件已变化,忽略Range返回整个文件
+bool http_conn::if_range_match()
+{
+    if (!m_if_range)
+        return true;
+    if (m_if_range[0] == '"')
+        return strcmp(m_if_range, m_meta.etag) == 0;
+    return strcmp(m_if_range, m_meta.last_modified) == 0;
+}
+
+bool http_conn::add_file_headers()
+{
+    if (!add_response("ETag:%s\r\nLast-Modified:%s\r\n", m_meta.etag, m_meta.last_modified))
+        return false;
+    if (m_meta.encodings && !add_response("Vary:Accept-Encoding\r\n"))
+        return false;
+    if (m_content_encoding)
+        return add_response("Content-Encoding:%s\r\n", m_content_encoding);
+    return true;
+}
+
+//解析Range: bytes=0-99,200-,-50
+//格式错误或区间过多时忽略Range,返回整个文件;所有区间都超出文件大小时返回false
+bool http_conn::parse_range()
+{
+    m_range_count = 0;
+    if (strncasecmp(m_range, "bytes=", 6) != 0)
+        return true;
 
-        bytes_have_send += temp;
-        bytes_to_send -= temp;
-        if (bytes_have_send >= m_iv[0].iov_len)
+    off_t size = m_file_stat.st_size;
+    int specs = 0;
+    char *p = m_range + 6;
+    while (true)
+    {
+        p += strspn(p, " \t");
+        off_t start, end;
+        char *q;
+        if (*p == '-')
         {
-            m_iv[0].iov_len = 0;
-            m_iv[1].iov_base = m_file_address + (bytes_have_send - m_write_idx);
-            m_iv[1].iov_len = bytes_to_send;
+            //后缀区间,取最后n个字节
+            if (*(p + 1) < '0' || *(p + 1) > '9')
+                break;
+            long long n = strtoll(p + 1, &q, 10);
+            start = n >= size ? 0 : size - n;
+            end = n > 0 ? size - 1 : -1;
         }
-        else
+        else if (*p >= '0' && *p <= '9')
         {
-            m_iv[0].iov_base = m_write_buf + bytes_have_send;
-            m_iv[0].iov_len = m_iv[0].iov_len - bytes_have_send;
+            start = strtoll(p, &q, 10);
+            if (*q++ != '-')
+                break;
+            end = size - 1;
+            if (*q >= '0' && *q <= '9')
+            {
+                long long last = strtoll(q, &q, 10);
+                if (last < start)
+                    break;
+                if (last < end)
+                    end = last;
+            }
         }
+        else
+            break;
 
-        if (bytes_to_send <= 0)
+        ++specs;
+        if (start <= end && start < size)
         {
-            unmap();
-            modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
+            if (m_range_count == MAX_RANGES)
+                break;
+            m_ranges[m_range_count].start = start;
+            m_ranges[m_range_count].end = end;
+            ++m_range_count;
+        }
+
+        p = q + strspn(q, " \t");
+        if (*p == '\0')
+            return specs == 0 || m_range_count > 0;
+        if (*p++ != ',')
+            break;
+    }
+    m_range_count = 0;
+    return true;
+}
+
+//单个区间直接发送文件中对应的片段,多个区间按multipart/byteranges组织
+bool http_conn::add_range_response()
+{
+    off_t size = m_file_stat.st_size;
+    add_status_line(206, partial_206_title);
+    add_file_headers();
+    if (m_range_count == 1)
+    {
+        byte_range &r = m_ranges[0];
+        off_t len = r.end - r.start + 1;
+        add_response("Content-Range:bytes %lld-%lld/%lld\r\n", (long long)r.start, (long long)r.end, (long long)size);
+        add_content_type();
+        if (!add_headers(len))
+            return false;
+        m_out.add_mem(m_write_buf, m_write_idx);
+        add_body(r.start, len);
+        bytes_to_send = m_out.size();
+        return true;
+    }
+
+    //分隔符由inode和修改时间生成,同一文件的响应保持一致
+    char boundary[40];
+    snprintf(boundary, sizeof(boundary), "%llx%llx",
+             (unsigned long long)m_file_stat.st_ino, (unsigned long long)m_file_stat.st_mtime);
+
+    //先生成全部头部,再取指针,避免string扩容后指针失效
+    size_t offsets[MAX_RANGES + 1];
+    off_t body_len = 0;
+    char buf[256];
+    m_part_heads.clear();
+    for (int i = 0; i < m_range_count; ++i)
+    {
+        byte_range &r = m_ranges[i];
+        offsets[i] = m_part_heads.size();
+        int n = snprintf(buf, sizeof(buf), "\r\n--%s\r\nContent-Type: %s\r\nContent-Range: bytes %lld-%lld/%lld\r\n\r\n",
+                         boundary, m_meta.content_type, (long long)r.start, (long long)r.end, (long long)size);
+        m_part_heads.append(buf, n);
+        body_len += r.end - r.start + 1;
+    }
+    offsets[m_range_count] = m_part_heads.size();
+    int n = snprintf(buf, sizeof(buf), "\r\n--%s--\r\n", boundary);
+    m_part_heads.append(buf, n);
+    body_len += m_part_heads.size();
+
+    add_response("Content-Type:multipart/byteranges; boundary=%s\r\n", boundary);
+    if (!add_headers(body_len))
+        return false;
+    m_out.add_mem(m_write_buf, m_write_idx);
+    const char *heads = m_part_heads.data();
+    for (int i = 0; i < m_range_count; ++i)
+    {
+        m_out.add_mem(heads + offsets[i], offsets[i + 1] - offsets[i]);
+        add_body(m_ranges[i].start, m_ranges[i].end - m_ranges[i].start + 1);
+    }
+    m_out.add_mem(heads + offsets[m_range_count], m_part_heads.size() - offsets[m_range_count]);
+    bytes_to_send = m_out.size();
+    return true;
+}
+
+//响应体的一段,来自压缩缓存时是内存段,否则是文件段
+void http_conn::add_body(off_t offset, size_t len)
+{
+    if (m_compressed)
+        m_out.add_mem(m_compressed->data() + offset, len);
+    else
+        m_out.add_file(m_file_fd, offset, len);
+}
+
+void http_conn::release_body()
+{
+    m_out.clear();
+    m_compressed.reset();
+    if (m_file_fd >= 0)
+    {
+        close(m_file_fd);
+        m_file_fd = -1;
+    }
+}
+
+//生成动态内容的下一段,以chunked编码加入发送链,生成完毕后加上结束块
+void http_conn::fill_stream()
+{
+    string part;
+    bool more = m_stream(m_stream_ctx, part, m_stream_cursor);
+    m_out.add_chunk(part.data(), part.size());
+    if (!more)
+    {
+        m_out.add_last_chunk();
+        m_stream = NULL;
+    }
+    bytes_to_send = m_out.size();
+}
 
-            if (m_linger)
+bool http_conn::write()
+{
+    ssize_t temp = 0;
+
+    if (m_out.empty() && !m_stream)
+    {
+        //process_write失败时没有响应,由事件循环关闭连接
+        if (!m_linger)
+            return false;
+        rearm(EPOLLIN);
+        init();
+        return true;
+    }
+
+    while (1)
+    {
+        output();
+        if (!m_out.empty())
+        {
+            temp = m_out.send(m_sockfd);
+            if (temp < 0 && errno == EAGAIN)
             {
-                init();
+                TRACE_WRITE_PARTIAL(m_sockfd, bytes_have_send, bytes_to_send);
+                rearm(EPOLLOUT);
                 return true;
             }
-            else
+            //sendfile返回0说明文件在发送期间被截断,无法补齐Content-Length
+            if (temp <= 0)
             {
+                release_body();
                 return false;
             }
+            bytes_have_send += temp;
+            bytes_to_send = m_out.size();
         }
+
+        if (m_out.empty() && !m_stream)
+            return finish_write();
+    }
+}
+
+out_chain *http_conn::output()
+{
+    //已生成的内容发完后再生成下一段,同一时刻只缓存一段
+    while (m_out.empty() && m_stream)
+        fill_stream();
+    return &m_out;
+}
+
+void http_conn::sent(size_t n)
+{
+    m_out.consume(n);
+    bytes_have_send += n;
+    bytes_to_send = m_out.size();
+}
+
+bool http_conn::finish_write()
+{
+    release_body();
+    long long now = metrics_now_ns();
+    Metrics::get_instance()->record_latency(PHASE_WRITE, m_ready_ns, now);
+    Metrics::get_instance()->record_latency(PHASE_TOTAL, m_start_ns, now);
+    Metrics::get_instance()->record_response(m_status, bytes_have_send);
+    TRACE_WRITE_DONE(m_sockfd, m_status, bytes_have_send);
+    write_access_log();
+    m_reuse++;
+
+    if (m_linger)
+    {
+        //已读入后续请求时不重新注册读事件,由调用方直接交给process()处理
+        init();
+        if (!pipelined())
+            rearm(EPOLLIN);
+        return true;
+    }
+    else
+    {
+        return false;
     }
 }
+
+void http_conn::read_from(const char *data, int len)
+{
+    if (m_read_idx == 0)
+        mark_request_start();
+    memcpy(m_read_buf + m_read_idx, data, len);
+    m_read_idx += len;
+}
+
+void http_conn::rearm(int ev)
+{
+    if (m_notify)
+        m_notify(this, ev);
+    else
+        modfd(m_epollfd, m_sockfd, key(), ev, m_TRIGMode);
+}
 bool http_conn::add_response(const char *format, ...)
 {
     if (m_write_idx >= WRITE_BUFFER_SIZE)
@@ -599,33 +1219,54 @@ bool http_conn::add_response(const char *format, ...)
 }
 bool http_conn::add_status_line(int status, const char *title)
 {
+    m_status = status;
     return add_response("%s %d %s\r\n", "HTTP/1.1", status, title);
 }
-bool http_conn::add_headers(int content_len)
+bool http_conn::add_headers(off_t content_len)
 {
     return add_content_length(content_len) && add_linger() &&
            add_blank_line();
 }
-bool http_conn::add_content_length(int content_len)
+bool http_conn::add_content_length(off_t content_len)
 {
-    return add_response("Content-Length:%d\r\n", content_len);
+    return add_response("Content-Length:%lld\r\n", (long long)content_len);
 }
 bool http_conn::add_content_type()
 {
-    return add_response("Content-Type:%s\r\n", "text/html");
+    return add_response("Content-Type:%s\r\n", m_meta.content_type);
 }
 bool http_conn::add_linger()
 {
+    if (__atomic_load_n(&m_draining, __ATOMIC_RELAXED))
+        m_linger = false;
     return add_response("Connection:%s\r\n", (m_linger == true) ? "keep-alive" : "close");
 }
 bool http_conn::add_blank_line()
 {
-    return add_response("%s", "\r\n");
+    if (!add_response("%s", "\r\n"))
+        return false;
+    m_header_len = m_write_idx;
+    return true;
 }
 bool http_conn::add_content(const char *content)
 {
     return add_response("%s", content);
 }
+void http_conn::write_access_log()
+{
+    if (!m_access_sampled)
+        return;
+
+    access_record rec;
+    rec.method = method_names[m_method];
+    rec.path = m_access_path;
+    rec.status = m_status;
+    rec.bytes = bytes_have_send;
+    rec.latency_us = m_start_ns ? (metrics_now_ns() - m_start_ns) / 1000 : 0;
+    rec.client = &m_address;
+    rec.reuse = m_reuse;
+    AccessLog::get_instance()->write(rec);
+}
 bool http_conn::process_write(HTTP_CODE ret)
 {
     switch (ret)
@@ -639,6 +1280,16 @@ bool http_conn::process_write(HTTP_CODE ret)
         break;
     }
     case BAD_REQUEST:
+    {
+        //请求无法继续解析,发送后关闭连接
+        m_linger = false;
+        add_status_line(400, error_400_title);
+        add_headers(strlen(error_400_form));
+        if (!add_content(error_400_form))
+            return false;
+        break;
+    }
+    case NO_RESOURCE:
     {
         add_status_line(404, error_404_title);
         add_headers(strlen(error_404_form));
@@ -646,6 +1297,43 @@ bool http_conn::process_write(HTTP_CODE ret)
             return false;
         break;
     }
+    case PAYLOAD_TOO_LARGE:
+    {
+        //请求体没有读完,不能继续解析后续请求
+        m_linger = false;
+        add_status_line(413, error_413_title);
+        add_headers(strlen(error_413_form));
+        if (!add_content(error_413_form))
+            return false;
+        break;
+    }
+    case METHOD_NOT_ALLOWED:
+    {
+        m_linger = false;
+        add_status_line(405, error_405_title);
+        add_response("Allow:%s\r\n", allowed_methods);
+        add_headers(strlen(error_405_form));
+        if (!add_content(error_405_form))
+            return false;
+        break;
+    }
+    case VERSION_NOT_SUPPORTED:
+    {
+        m_linger = false;
+        add_status_line(505, error_505_title);
+        add_headers(strlen(error_505_form));
+        if (!add_content(error_505_form))
+            return false;
+        break;
+    }
+    case OPTIONS_REQUEST:
+    {
+        add_status_line(200, ok_200_title);
+        add_response("Allow:%s\r\n", allowed_methods);
+        if (!add_headers(0))
+            return false;
+        break;
+    }
     case FORBIDDEN_REQUEST:
     {
         add_status_line(403, error_403_title);
@@ -654,18 +1342,38 @@ bool http_conn::process_write(HTTP_CODE ret)
             return false;
         break;
     }
+    case RANGE_NOT_SATISFIABLE:
+    {
+        add_status_line(416, error_416_title);
+        add_response("Content-Range:bytes */%lld\r\n", (long long)m_file_stat.st_size);
+        add_headers(strlen(error_416_form));
+        if (!add_content(error_416_form))
+            return false;
+        break;
+    }
+    case NOT_MODIFIED:
+    {
+        //304不带响应体,也不发送Content-Length
+        add_status_line(304, not_modified_304_title);
+        add_file_headers();
+        if (!add_linger() || !add_blank_line())
+            return false;
+        break;
+    }
     case FILE_REQUEST:
     {
+        if (m_range_count > 0)
+            return add_range_response();
         add_status_line(200, ok_200_title);
+        add_file_headers();
         if (m_file_stat.st_size != 0)
         {
+            add_response("Accept-Ranges:bytes\r\n");
+            add_content_type();
             add_headers(m_file_stat.st_size);
-            m_iv[0].iov_base = m_write_buf;
-            m_iv[0].iov_len = m_write_idx;
-            m_iv[1].iov_base = m_file_address;
-            m_iv[1].iov_len = m_file_stat.st_size;
-            m_iv_count = 2;
-            bytes_to_send = m_write_idx + m_file_stat.st_size;
+            m_out.add_mem(m_write_buf, m_write_idx);
+            add_body(0, m_file_stat.st_size);
+            bytes_to_send = m_out.size();
             return true;
         }
         else
@@ -675,14 +1383,40 @@ bool http_conn::process_write(HTTP_CODE ret)
             if (!add_content(ok_string))
                 return false;
         }
+        break;
+    }
+    case DYNAMIC_REQUEST:
+    {
+        add_status_line(200, ok_200_title);
+        add_response("Content-Type:%s\r\n", m_stream_type);
+        if (m_http10)
+        {
+            //HTTP/1.0不认识chunked,全部生成后按Content-Length发送
+            while (m_stream(m_stream_ctx, m_dyn_body, m_stream_cursor))
+                ;
+            m_stream = NULL;
+            add_headers(m_dyn_body.size());
+            m_out.add_mem(m_write_buf, m_write_idx);
+            m_out.add_mem(m_dyn_body.data(), m_dyn_body.size());
+        }
+        else
+        {
+            //边生成边发送,不必先拼出整个响应体
+            add_response("Transfer-Encoding:chunked\r\n");
+            add_linger();
+            add_blank_line();
+            m_out.add_mem(m_write_buf, m_write_idx);
+            if (m_method != HEAD)
+                fill_stream();
+        }
+        bytes_to_send = m_out.size();
+        return true;
     }
     default:
         return false;
     }
-    m_iv[0].iov_base = m_write_buf;
-    m_iv[0].iov_len = m_write_idx;
-    m_iv_count = 1;
-    bytes_to_send = m_write_idx;
+    m_out.add_mem(m_write_buf, m_write_idx);
+    bytes_to_send = m_out.size();
     return true;
 }
 void http_conn::process()
@@ -690,13 +1424,49 @@ void http_conn::process()
     HTTP_CODE read_ret = process_read();
     if (read_ret == NO_REQUEST)
     {
-        modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
+        rearm(EPOLLIN);
         return;
     }
+    if (read_ret == DB_REQUEST)
+    {
+        //执行器入队时已登记,本线程返回后连接仍不会被关闭或复用
+        if (m_db_submit && m_db_submit(this))
+            return;
+        connectionRAII mysqlcon(&mysql, connection_pool::GetInstance());
+        process_db();
+        return;
+    }
+    finish_process(read_ret);
+}
+
+void http_conn::process_db()
+{
+    long long t = metrics_now_ns();
+    HTTP_CODE ret = (this->*m_db_handler)(NULL);
+    Metrics::get_instance()->record_latency(PHASE_DO_DB, t, metrics_now_ns());
+    TRACE_DO_REQUEST(m_sockfd, (int)ret, 1);
+    finish_process(ret);
+}
+
+//生成响应并交还事件循环发送
+void http_conn::finish_process(HTTP_CODE read_ret)
+{
     bool write_ret = process_write(read_ret);
     if (!write_ret)
     {
-        close_conn();
+        //不在工作线程中关闭socket,否则fd可能在定时器关闭前被新连接复用
+        release_body();
+        m_stream = NULL;
+        m_linger = false;
+    }
+    else if (m_method == HEAD)
+    {
+        //HEAD与GET的头部相同,只是不发送响应体
+        m_out.clear();
+        m_out.add_mem(m_write_buf, m_header_len);
+        m_stream = NULL;
+        bytes_to_send = m_header_len;
     }
-    modfd(m_epollfd, m_sockfd, EPOLLOUT, m_TRIGMode);
+    m_ready_ns = metrics_now_ns();
+    rearm(EPOLLOUT);
 }
@@ -20,18 +20,32 @@
 #include <sys/wait.h>
 #include <sys/uio.h>
 #include <map>
+#include <string>
+#include <memory>
 
 #include "../lock/locker.h"
 #include "../CGImysql/sql_connection_pool.h"
 #include "../timer/lst_timer.h"
 #include "../log/log.h"
+#include "../log/access_log.h"
+#include "../metrics/metrics.h"
+#include "../trace/trace.h"
+#include "file_cache.h"
+#include "compress_cache.h"
+#include "body_buffer.h"
+#include "out_chain.h"
+#include "route_table.h"
 
 class http_conn
 {
+    friend class http_conn_bench;
+
 public:
     static const int FILENAME_LEN = 200;
     static const int READ_BUFFER_SIZE = 2048;
     static const int WRITE_BUFFER_SIZE = 1024;
+    static const int MAX_RANGES = 8; //单个请求最多的Range区间数,超过时返回整个文件
+    static const long long MAX_BODY_SIZE = 16 * 1024 * 1024; //请求体上限,超过返回413
     enum METHOD
     {
         GET = 0,
@@ -58,8 +72,23 @@ public:
         NO_RESOURCE,
         FORBIDDEN_REQUEST,
         FILE_REQUEST,
+        DYNAMIC_REQUEST,
+        RANGE_NOT_SATISFIABLE,
+        NOT_MODIFIED,
+        OPTIONS_REQUEST,
+        METHOD_NOT_ALLOWED,
+        VERSION_NOT_SUPPORTED,
+        PAYLOAD_TOO_LARGE,
         INTERNAL_ERROR,
-        CLOSED_CONNECTION
+        CLOSED_CONNECTION,
+        DB_REQUEST          //交给数据库执行器,响应由执行器生成
+    };
+    enum CHUNK_STATE
+    {
+        CHUNK_SIZE = 0,  //块大小行
+        CHUNK_DATA,      //块数据
+        CHUNK_DATA_END,  //块数据后的CRLF
+        CHUNK_TRAILER    //最后一块之后的trailer
     };
     enum LINE_STATUS
     {
@@ -69,20 +98,60 @@ public:
     };
 
 public:
-    http_conn() {}
+    http_conn() : m_slot(0), m_gen(0), m_workers(0), m_file_fd(-1), m_stream(NULL) {}
     ~http_conn() {}
 
 public:
-    void init(int sockfd, const sockaddr_in &addr, char *, int, int, string user, string passwd, string sqlname);
-    void close_conn(bool real_close = true);
+    void init(int sockfd, const sockaddr_storage &addr, char *, int, int, string user, string passwd, string sqlname);
     void process();
+    //数据库执行器中调用,此时已取得数据库连接
+    void process_db();
     bool read_once();
     bool write();
-    sockaddr_in *get_address()
+    sockaddr_storage *get_address()
     {
         return &m_address;
     }
+    int get_sockfd() { return m_sockfd; }
+    //keep-alive连接上已读入但尚未处理的后续请求(pipeline)
+    //响应未发完时读缓冲区中仍是当前请求,不算
+    bool pipelined() { return m_read_idx > 0 && !sending(); }
     void initmysql_result(connection_pool *connPool);
+    //注册内置的动态地址,启动时在工作线程运行前调用一次
+    static void init_routes();
+
+    //以下供io_uring后端使用,收发由事件循环提交,不经过read_once/write
+    //读缓冲区剩余空间
+    int read_space() { return READ_BUFFER_SIZE - m_read_idx; }
+    //追加收到的数据
+    void read_from(const char *data, int len);
+    //待发送的响应,动态内容按需生成下一段;为空表示响应已发完
+    out_chain *output();
+    //已发送n字节
+    void sent(size_t n);
+    //响应发完后记录指标并准备下一个请求,返回false表示应关闭连接
+    bool finish_write();
+    //发送失败关闭连接前释放响应体
+    void release_body();
+    //响应还有未发出的内容
+    bool sending() { return !m_out.empty() || m_stream; }
+
+    //事件数据:高32位为代数,低32位为连接池中的位置;代数每次init加一且不为0,与以fd注册的描述符区分
+    uint64_t key() const { return ((uint64_t)m_gen << 32) | (unsigned)m_slot; }
+    unsigned gen() const { return m_gen; }
+    //线程池入队时加一,工作线程处理完后减一;不为0时事件循环不关闭也不复用这个连接对象
+    void enter_worker() { __atomic_add_fetch(&m_workers, 1, __ATOMIC_RELAXED); }
+    void leave_worker() { __atomic_sub_fetch(&m_workers, 1, __ATOMIC_RELEASE); }
+    bool in_worker() const { return __atomic_load_n(&m_workers, __ATOMIC_ACQUIRE) > 0; }
+
+    //不为空时,需要重新监听读写事件的地方改为调用它,由事件循环决定如何继续
+    static void (*m_notify)(http_conn *conn, int ev);
+    //把连接交给数据库执行器,返回false时在当前线程直接访问数据库
+    static bool (*m_db_submit)(http_conn *conn);
+    //进程准备退出:之后的响应都带Connection: close,发完后关闭连接
+    static bool m_draining;
+    //已完成至少一个请求,正在等待下一个请求的keep-alive连接
+    bool idle() { return m_reuse > 0 && m_read_idx == 0 && !sending(); }
     int timer_flag;
     int improv;
 
@@ -93,29 +162,68 @@ private:
     bool process_write(HTTP_CODE ret);
     HTTP_CODE parse_request_line(char *text);
     HTTP_CODE parse_headers(char *text);
-    HTTP_CODE parse_content(char *text);
+    HTTP_CODE parse_content();
+    HTTP_CODE parse_chunked();
+    void compact_body();
+    void send_continue();
     HTTP_CODE do_request();
+    HTTP_CODE serve_file(const char *url);
+    HTTP_CODE route_page(const char *url);
+    HTTP_CODE route_metrics(const char *);
+    HTTP_CODE route_login(const char *);
+    HTTP_CODE route_register(const char *);
+    bool parse_user(char *name, char *password);
+    HTTP_CODE dispatch_request(long long parse_start);
+    void finish_process(HTTP_CODE ret);
+    void mark_request_start();
     char *get_line() { return m_read_buf + m_start_line; };
     LINE_STATUS parse_line();
-    void unmap();
+    void rearm(int ev);
+    void add_body(off_t offset, size_t len);
+    void fill_stream();
     bool add_response(const char *format, ...);
     bool add_content(const char *content);
     bool add_status_line(int status, const char *title);
-    bool add_headers(int content_length);
+    bool add_headers(off_t content_length);
     bool add_content_type();
-    bool add_content_length(int content_length);
+    bool add_content_length(off_t content_length);
     bool add_linger();
     bool add_blank_line();
+    void write_access_log();
+    void select_encoding();
+    bool use_sibling(const char *ext);
+    bool not_modified();
+    bool if_range_match();
+    bool add_file_headers();
+    bool parse_range();
+    bool add_range_response();
 
 public:
     static int m_epollfd;
     static int m_user_count;
     MYSQL *mysql;
     int m_state;  //读为0, 写为1
+    long long m_enqueue_ns; //进入线程池队列的时间
+    int m_slot;             //在连接池中的位置,创建连接池时设置
 
 private:
+    //路由处理函数,参数为注册时传入的arg
+    typedef HTTP_CODE (http_conn::*route_handler)(const char *arg);
+    static route_table<route_handler> m_routes;
+    //流式生成动态内容,每次追加一段,返回false表示结束
+    //ctx由路由处理函数提供,须在响应发送完之前有效,cursor每个请求从0开始
+    typedef bool (*stream_fn)(void *ctx, string &out, int &cursor);
+    HTTP_CODE stream_response(stream_fn fn, void *ctx, const char *content_type);
+    //访问数据库的部分,在数据库执行器中调用
+    HTTP_CODE defer_db(route_handler handler);
+    HTTP_CODE db_login(const char *);
+    HTTP_CODE db_register(const char *);
+    route_handler m_db_handler;
+
+    unsigned m_gen;
+    int m_workers;
     int m_sockfd;
-    sockaddr_in m_address;
+    sockaddr_storage m_address;
     char m_read_buf[READ_BUFFER_SIZE];
     int m_read_idx;
     int m_checked_idx;
@@ -128,22 +236,58 @@ private:
     char *m_url;
     char *m_version;
     char *m_host;
-    int m_content_length;
+    char *m_range;    //Range请求头
+    char *m_if_range; //If-Range请求头
+    char *m_if_none_match;
+    char *m_if_modified_since;
+    char *m_accept_encoding;
+    long long m_content_length;
+    bool m_chunked;          //Transfer-Encoding: chunked
+    bool m_expect_continue;  //Expect: 100-continue
+    CHUNK_STATE m_chunk_state;
+    long long m_chunk_left;  //当前块剩余的字节数
+    int m_body_start;        //请求体在读缓冲区中的起始位置,之前是请求行和头部
+    body_buffer m_body;
     bool m_linger;
-    char *m_file_address;
+    bool m_http10;   //HTTP/1.0请求,默认短连接
+    int m_header_len; //响应头部长度,HEAD请求只发送这部分
+    int m_file_fd; //响应体文件,HEAD和使用压缩缓存时为-1
     struct stat m_file_stat;
-    struct iovec m_iv[2];
-    int m_iv_count;
-    int cgi;        //是否启用的POST
-    char *m_string; //存储请求头数据
-    int bytes_to_send;
-    int bytes_have_send;
+    file_meta m_meta; //ETag、Last-Modified等,来自FileCache
+    const char *m_content_encoding;     //为空表示返回原始内容
+    shared_ptr<const string> m_compressed; //压缩缓存中的内容,发送期间持有
+    out_chain m_out;   //待发送的响应头部和响应体
+    string m_dyn_body; //HTTP/1.0不支持chunked,动态内容一次生成
+    stream_fn m_stream; //为空表示没有待生成的内容
+    void *m_stream_ctx;
+    int m_stream_cursor;
+    const char *m_stream_type; //动态内容的Content-Type
+    struct byte_range
+    {
+        off_t start;
+        off_t end; //包含
+    };
+    byte_range m_ranges[MAX_RANGES];
+    int m_range_count;  //0表示返回整个文件
+    string m_part_heads; //multipart/byteranges各部分的头部
+    char *m_string; //存储请求体数据,在临时文件中时为NULL
+    off_t bytes_to_send;
+    off_t bytes_have_send;
     char *doc_root;
 
     map<string, string> m_users;
     int m_TRIGMode;
     int m_close_log;
 
+    //访问日志相关
+    int m_status;           //响应状态码
+    int m_reuse;            //当前连接已完成的请求数
+    long long m_start_ns;   //收到请求首字节的时间
+    long long m_accept_ns;  //accept的时间,收到首字节后清零
+    long long m_ready_ns;   //响应生成完毕的时间
+    bool m_access_sampled;  //本次请求是否被采样
+    char m_access_path[FILENAME_LEN];
+
     char sql_user[100];
     char sql_passwd[100];
     char sql_name[100];
@@ -0,0 +1,134 @@
+#ifndef MIME_H
+#define MIME_H
+
+#include <strings.h>
+
+//扩展名到Content-Type的映射,编译期生成无冲突的哈希表
+//运行时只需一次哈希和一次比较,结果缓存在file_meta中,每个文件只查一次
+struct mime_type
+{
+    const char *ext;
+    const char *type;
+    bool compressible; //压缩缓存是否处理该类型
+};
+
+static constexpr mime_type mime_types[] = {
+    {"html", "text/html; charset=utf-8", true},
+    {"htm", "text/html; charset=utf-8", true},
+    {"css", "text/css; charset=utf-8", true},
+    {"js", "application/javascript; charset=utf-8", true},
+    {"json", "application/json", true},
+    {"txt", "text/plain; charset=utf-8", true},
+    {"xml", "application/xml", true},
+    {"md", "text/markdown; charset=utf-8", true},
+    {"svg", "image/svg+xml", true},
+    {"ico", "image/x-icon", true},
+    {"jpg", "image/jpeg", false},
+    {"jpeg", "image/jpeg", false},
+    {"png", "image/png", false},
+    {"gif", "image/gif", false},
+    {"webp", "image/webp", false},
+    {"bmp", "image/bmp", false},
+    {"mp4", "video/mp4", false},
+    {"webm", "video/webm", false},
+    {"ogg", "video/ogg", false},
+    {"avi", "video/x-msvideo", false},
+    {"mov", "video/quicktime", false},
+    {"mp3", "audio/mpeg", false},
+    {"wav", "audio/wav", false},
+    {"pdf", "application/pdf", false},
+    {"woff", "font/woff", false},
+    {"woff2", "font/woff2", false},
+    {"ttf", "font/ttf", true},
+    {"wasm", "application/wasm", true},
+    {"zip", "application/zip", false},
+    {"gz", "application/gzip", false},
+};
+
+static const char *const MIME_DEFAULT = "application/octet-stream";
+
+constexpr int MIME_COUNT = sizeof(mime_types) / sizeof(mime_types[0]);
+constexpr int MIME_SLOT_BITS = 7;
+constexpr int MIME_SLOTS = 1 << MIME_SLOT_BITS; //留足空位,编译期很快能找到无冲突的种子
+static_assert(MIME_SLOTS >= 4 * MIME_COUNT, "mime table too small");
+
+//不区分大小写的FNV-1a
+constexpr unsigned mime_hash(const char *s, unsigned seed)
+{
+    unsigned h = 2166136261u ^ seed;
+    for (; *s; ++s)
+    {
+        char c = (*s >= 'A' && *s <= 'Z') ? *s - 'A' + 'a' : *s;
+        h = (h ^ (unsigned char)c) * 16777619u;
+    }
+    //乘法只向高位扩散,取高位
+    return h >> (32 - MIME_SLOT_BITS);
+}
+
+constexpr bool mime_seed_ok(unsigned seed)
+{
+    bool used[MIME_SLOTS] = {};
+    for (int i = 0; i < MIME_COUNT; ++i)
+    {
+        unsigned h = mime_hash(mime_types[i].ext, seed);
+        if (used[h])
+            return false;
+        used[h] = true;
+    }
+    return true;
+}
+
+constexpr unsigned mime_find_seed()
+{
+    for (unsigned seed = 0; seed < 100000; ++seed)
+    {
+        if (mime_seed_ok(seed))
+            return seed;
+    }
+    return ~0u;
+}
+
+constexpr unsigned MIME_SEED = mime_find_seed();
+static_assert(MIME_SEED != ~0u, "no collision-free seed for mime table");
+
+struct mime_index
+{
+    signed char slot[MIME_SLOTS]; //-1表示空
+};
+
+constexpr mime_index mime_build()
+{
+    mime_index t = {};
+    for (int i = 0; i < MIME_SLOTS; ++i)
+        t.slot[i] = -1;
+    for (int i = 0; i < MIME_COUNT; ++i)
+        t.slot[mime_hash(mime_types[i].ext, MIME_SEED)] = i;
+    return t;
+}
+
+constexpr mime_index MIME_INDEX = mime_build();
+
+//ext不含点,未知扩展名返回NULL
+inline const mime_type *mime_lookup(const char *ext)
+{
+    int i = MIME_INDEX.slot[mime_hash(ext, MIME_SEED)];
+    if (i < 0 || strcasecmp(mime_types[i].ext, ext) != 0)
+        return 0;
+    return &mime_types[i];
+}
+
+//按文件路径的扩展名查找
+inline const mime_type *mime_of_path(const char *path)
+{
+    const char *ext = 0;
+    for (const char *p = path; *p; ++p)
+    {
+        if (*p == '.')
+            ext = p + 1;
+        else if (*p == '/')
+            ext = 0;
+    }
+    return ext ? mime_lookup(ext) : 0;
+}
+
+#endif
@@ -0,0 +1,139 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include "out_chain.h"
+
+void out_chain::add_mem(const char *data, size_t len)
+{
+    if (len == 0)
+        return;
+    segment s = {data, -1, 0, len, false};
+    m_segs.push_back(s);
+    m_size += len;
+}
+
+void out_chain::add_copy(const char *data, size_t len)
+{
+    if (len == 0)
+        return;
+    //deque尾部插入不会使已有元素的地址失效
+    m_bufs.push_back(string(data, len));
+    segment s = {m_bufs.back().data(), -1, 0, len, true};
+    m_segs.push_back(s);
+    m_size += len;
+    m_buffered += len;
+}
+
+void out_chain::add_file(int fd, off_t offset, size_t len)
+{
+    if (len == 0)
+        return;
+    segment s = {NULL, fd, offset, len, false};
+    m_segs.push_back(s);
+    m_size += len;
+}
+
+void out_chain::add_chunk(const char *data, size_t len)
+{
+    if (len == 0)
+        return;
+    char head[24];
+    int n = snprintf(head, sizeof(head), "%zx\r\n", len);
+    string buf;
+    buf.reserve(n + len + 2);
+    buf.append(head, n);
+    buf.append(data, len);
+    buf.append("\r\n", 2);
+    add_copy(buf.data(), buf.size());
+}
+
+void out_chain::add_last_chunk()
+{
+    add_mem("0\r\n\r\n", 5);
+}
+
+ssize_t out_chain::send(int sockfd)
+{
+    if (m_segs.empty())
+        return 0;
+
+    ssize_t n;
+    segment &front = m_segs.front();
+    if (!front.data)
+    {
+        off_t offset = front.offset;
+        n = sendfile(sockfd, front.fd, &offset, front.len);
+    }
+    else
+    {
+        struct iovec iov[MAX_IOV];
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = this->iov(iov, MAX_IOV);
+        size_t bytes = 0;
+        for (size_t i = 0; i < msg.msg_iovlen; ++i)
+            bytes += iov[i].iov_len;
+        //后面还有文件段时带MSG_MORE,避免头部单独成包后因Nagle等待对端的延迟ACK
+        n = sendmsg(sockfd, &msg, bytes < m_size ? MSG_MORE : 0);
+    }
+    if (n > 0)
+        consume(n);
+    return n;
+}
+
+int out_chain::iov(struct iovec *iov, int max) const
+{
+    int count = 0;
+    for (size_t i = 0; i < m_segs.size() && count < max && m_segs[i].data; ++i)
+    {
+        iov[count].iov_base = (void *)m_segs[i].data;
+        iov[count].iov_len = m_segs[i].len;
+        ++count;
+    }
+    return count;
+}
+
+bool out_chain::front_file(int &fd, off_t &offset, size_t &len) const
+{
+    if (m_segs.empty() || m_segs.front().data)
+        return false;
+    fd = m_segs.front().fd;
+    offset = m_segs.front().offset;
+    len = m_segs.front().len;
+    return true;
+}
+
+void out_chain::consume(size_t n)
+{
+    m_size -= n;
+    while (n > 0)
+    {
+        segment &s = m_segs.front();
+        size_t k = n < s.len ? n : s.len;
+        if (s.data)
+            s.data += k;
+        else
+            s.offset += k;
+        s.len -= k;
+        n -= k;
+        if (s.len == 0)
+        {
+            if (s.owned)
+            {
+                m_buffered -= m_bufs.front().size();
+                m_bufs.pop_front();
+            }
+            m_segs.pop_front();
+        }
+    }
+}
+
+void out_chain::clear()
+{
+    m_segs.clear();
+    m_bufs.clear();
+    m_size = 0;
+    m_buffered = 0;
+}
@@ -0,0 +1,63 @@
+#ifndef OUT_CHAIN_H
+#define OUT_CHAIN_H
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <deque>
+#include <string>
+
+using namespace std;
+
+//待发送的响应,由内存段和文件段按顺序组成
+//连续的内存段用sendmsg一次发出,文件段用sendfile发送,部分发送后从断点继续
+class out_chain
+{
+public:
+    static const int MAX_IOV = 64;
+
+    out_chain() : m_size(0), m_buffered(0) {}
+
+    //不拷贝,调用方保证发送完之前data有效
+    void add_mem(const char *data, size_t len);
+    //拷贝到链内部的缓冲区
+    void add_copy(const char *data, size_t len);
+    //fd由调用方负责关闭
+    void add_file(int fd, off_t offset, size_t len);
+    //Transfer-Encoding: chunked的一块,len为0时不发送
+    void add_chunk(const char *data, size_t len);
+    //结束块,之后不再发送trailer
+    void add_last_chunk();
+
+    bool empty() const { return m_segs.empty(); }
+    //剩余未发送的字节数
+    size_t size() const { return m_size; }
+    //链内部缓冲区占用的字节数
+    size_t buffered() const { return m_buffered; }
+
+    //发送一次,返回值与sendmsg/sendfile相同
+    ssize_t send(int sockfd);
+    void clear();
+
+    //由调用方自行发送时使用:取开头连续的内存段,返回个数,开头是文件段时为0
+    int iov(struct iovec *iov, int max) const;
+    //开头是文件段时取出其位置
+    bool front_file(int &fd, off_t &offset, size_t &len) const;
+    //已发送n字节
+    void consume(size_t n);
+
+private:
+    struct segment
+    {
+        const char *data; //为NULL时是文件段
+        int fd;
+        off_t offset;
+        size_t len;
+        bool owned; //数据在m_bufs中
+    };
+    deque<segment> m_segs;
+    deque<string> m_bufs; //按段的顺序保存拷贝的数据,段发完后释放
+    size_t m_size;
+    size_t m_buffered;
+};
+
+#endif
@@ -0,0 +1,126 @@
+#ifndef ROUTE_TABLE_H
+#define ROUTE_TABLE_H
+
+#include <stddef.h>
+#include <vector>
+
+using namespace std;
+
+//按请求方法和路径查找处理函数的前缀树
+//路由在启动时注册,之后只读,查找不加锁、不分配内存,耗时与路径长度成正比
+//精确匹配优先,否则取最长的前缀匹配;路径在'\0'或'?'处结束
+template <typename H>
+class route_table
+{
+public:
+    struct route
+    {
+        unsigned methods; //按方法编号的位掩码
+        H handler;
+        const char *arg;  //注册时传入,交给处理函数
+        int next;         //同一路径上的下一条路由
+    };
+
+public:
+    route_table() { m_nodes.push_back(node()); }
+
+    //methods为(1 << 方法编号)的组合,prefix为true时匹配以path开头的所有路径
+    void add(unsigned methods, const char *path, bool prefix, H handler, const char *arg)
+    {
+        int cur = 0;
+        for (const unsigned char *p = (const unsigned char *)path; *p; ++p)
+            cur = child(cur, *p, true);
+
+        route r;
+        r.methods = methods;
+        r.handler = handler;
+        r.arg = arg;
+        int &head = prefix ? m_nodes[cur].prefix : m_nodes[cur].exact;
+        r.next = head;
+        m_routes.push_back(r);
+        head = m_routes.size() - 1;
+    }
+
+    //没有匹配的路由时返回NULL
+    const route *match(int method, const char *path) const
+    {
+        unsigned bit = 1u << method;
+        const route *best = find(m_nodes[0].prefix, bit);
+        int cur = 0;
+        for (const unsigned char *p = (const unsigned char *)path; *p && *p != '?'; ++p)
+        {
+            cur = child(cur, *p);
+            if (cur < 0)
+                return best;
+            const route *r = find(m_nodes[cur].prefix, bit);
+            if (r)
+                best = r;
+        }
+        const route *r = find(m_nodes[cur].exact, bit);
+        return r ? r : best;
+    }
+
+    int size() const { return m_routes.size(); }
+
+private:
+    struct node
+    {
+        unsigned char c;
+        int child;   //第一个子节点,子节点按字符升序排列
+        int sibling; //下一个兄弟节点
+        int exact;   //精确匹配的路由链
+        int prefix;  //前缀匹配的路由链
+
+        node() : c(0), child(-1), sibling(-1), exact(-1), prefix(-1) {}
+    };
+
+    int child(int cur, unsigned char c) const
+    {
+        int i = m_nodes[cur].child;
+        while (i >= 0 && m_nodes[i].c < c)
+            i = m_nodes[i].sibling;
+        return i >= 0 && m_nodes[i].c == c ? i : -1;
+    }
+
+    int child(int cur, unsigned char c, bool create)
+    {
+        int found = child(cur, c);
+        if (found >= 0 || !create)
+            return found;
+
+        node n;
+        n.c = c;
+        int idx = m_nodes.size();
+        //找到插入位置,保持兄弟链有序
+        int prev = -1;
+        int i = m_nodes[cur].child;
+        while (i >= 0 && m_nodes[i].c < c)
+        {
+            prev = i;
+            i = m_nodes[i].sibling;
+        }
+        n.sibling = i;
+        m_nodes.push_back(n);
+        if (prev < 0)
+            m_nodes[cur].child = idx;
+        else
+            m_nodes[prev].sibling = idx;
+        return idx;
+    }
+
+    const route *find(int i, unsigned bit) const
+    {
+        for (; i >= 0; i = m_routes[i].next)
+        {
+            if (m_routes[i].methods & bit)
+                return &m_routes[i];
+        }
+        return NULL;
+    }
+
+private:
+    vector<node> m_nodes;
+    vector<route> m_routes;
+};
+
+#endif
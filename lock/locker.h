@@ -4,6 +4,8 @@
 #include <exception>
 #include <pthread.h>
 #include <semaphore.h>
+#include <time.h>
+#include <errno.h>
 
 class sem
 {
@@ -30,6 +32,23 @@ public:
     {
         return sem_wait(&m_sem) == 0;
     }
+    //超时返回false,被信号打断时继续等待
+    bool timedwait(int ms)
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += ms / 1000;
+        ts.tv_nsec += (ms % 1000) * 1000000L;
+        if (ts.tv_nsec >= 1000000000L)
+        {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000L;
+        }
+        int ret;
+        while ((ret = sem_timedwait(&m_sem, &ts)) != 0 && errno == EINTR)
+            ;
+        return ret == 0;
+    }
     bool post()
     {
         return sem_post(&m_sem) == 0;
@@ -0,0 +1,168 @@
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
+#include "access_log.h"
+
+int format_addr(const sockaddr_storage *addr, char *buf, size_t len)
+{
+    char ip[INET6_ADDRSTRLEN] = "-";
+    int port = 0;
+    if (addr->ss_family == AF_INET6)
+    {
+        const sockaddr_in6 *a = (const sockaddr_in6 *)addr;
+        port = ntohs(a->sin6_port);
+        if (!IN6_IS_ADDR_V4MAPPED(&a->sin6_addr))
+        {
+            inet_ntop(AF_INET6, &a->sin6_addr, ip, sizeof(ip));
+            return snprintf(buf, len, "[%s]:%d", ip, port);
+        }
+        inet_ntop(AF_INET, &a->sin6_addr.s6_addr[12], ip, sizeof(ip));
+    }
+    else if (addr->ss_family == AF_INET)
+    {
+        const sockaddr_in *a = (const sockaddr_in *)addr;
+        port = ntohs(a->sin_port);
+        inet_ntop(AF_INET, &a->sin_addr, ip, sizeof(ip));
+    }
+    return snprintf(buf, len, "%s:%d", ip, port);
+}
+
+using namespace std;
+
+static const char *field_names[AccessLog::F_COUNT] = {
+    "method", "path", "status", "bytes", "latency_us", "client", "reuse"};
+
+AccessLog::AccessLog()
+{
+    m_fp = NULL;
+    m_sample = 0;
+    m_field_count = 0;
+    m_queue = NULL;
+    m_dropped = 0;
+}
+
+AccessLog::~AccessLog()
+{
+    if (m_fp != NULL)
+    {
+        fclose(m_fp);
+    }
+}
+
+bool AccessLog::parse_fields(const char *fields)
+{
+    m_field_count = 0;
+    if (fields == NULL || fields[0] == '\0')
+    {
+        for (int i = 0; i < F_COUNT; ++i)
+            m_fields[m_field_count++] = i;
+        return true;
+    }
+
+    char buf[256] = {0};
+    strncpy(buf, fields, sizeof(buf) - 1);
+    char *save = NULL;
+    for (char *tok = strtok_r(buf, ",", &save); tok; tok = strtok_r(NULL, ",", &save))
+    {
+        int i = 0;
+        for (; i < F_COUNT; ++i)
+        {
+            if (strcasecmp(tok, field_names[i]) == 0)
+                break;
+        }
+        if (i == F_COUNT || m_field_count >= F_COUNT)
+            return false;
+        m_fields[m_field_count++] = i;
+    }
+    return m_field_count > 0;
+}
+
+bool AccessLog::init(const char *file_name, int sample, const char *fields, int max_queue_size)
+{
+    if (sample <= 0)
+        return true;
+    if (!parse_fields(fields))
+        return false;
+
+    m_fp = fopen(file_name, "a");
+    if (m_fp == NULL)
+        return false;
+
+    //写文件只在专用线程中进行,工作线程只负责格式化和入队
+    m_queue = new block_queue<string>(max_queue_size);
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, flush_access_log_thread, NULL) != 0)
+        return false;
+    pthread_detach(tid);
+
+    m_sample = sample;
+    return true;
+}
+
+void AccessLog::write(const access_record &rec)
+{
+    char buf[512];
+    struct timeval now = {0, 0};
+    gettimeofday(&now, NULL);
+    struct tm my_tm;
+    localtime_r(&now.tv_sec, &my_tm);
+
+    int n = snprintf(buf, sizeof(buf), "%d-%02d-%02d %02d:%02d:%02d.%06ld",
+                     my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday,
+                     my_tm.tm_hour, my_tm.tm_min, my_tm.tm_sec, now.tv_usec);
+
+    for (int i = 0; i < m_field_count && n < (int)sizeof(buf); ++i)
+    {
+        int left = sizeof(buf) - n;
+        switch (m_fields[i])
+        {
+        case F_METHOD:
+            n += snprintf(buf + n, left, " method=%s", rec.method);
+            break;
+        case F_PATH:
+            n += snprintf(buf + n, left, " path=%s", rec.path ? rec.path : "-");
+            break;
+        case F_STATUS:
+            n += snprintf(buf + n, left, " status=%d", rec.status);
+            break;
+        case F_BYTES:
+            n += snprintf(buf + n, left, " bytes=%lld", rec.bytes);
+            break;
+        case F_LATENCY:
+            n += snprintf(buf + n, left, " latency_us=%lld", rec.latency_us);
+            break;
+        case F_CLIENT:
+        {
+            char addr[INET6_ADDRSTRLEN + 8];
+            format_addr(rec.client, addr, sizeof(addr));
+            n += snprintf(buf + n, left, " client=%s", addr);
+            break;
+        }
+        case F_REUSE:
+            n += snprintf(buf + n, left, " reuse=%d", rec.reuse);
+            break;
+        }
+    }
+    if (n > (int)sizeof(buf) - 2)
+        n = sizeof(buf) - 2;
+    buf[n++] = '\n';
+    buf[n] = '\0';
+
+    //队列满时丢弃,不阻塞工作线程
+    if (!m_queue->push(string(buf, n)))
+        __sync_fetch_and_add(&m_dropped, 1);
+}
+
+void AccessLog::async_write()
+{
+    string line;
+    while (true)
+    {
+        //空闲1秒后刷盘,繁忙时依靠stdio缓冲批量写入
+        if (m_queue->pop(line, 1000))
+            fputs(line.c_str(), m_fp);
+        else
+            fflush(m_fp);
+    }
+}
@@ -0,0 +1,87 @@
+#ifndef ACCESS_LOG_H
+#define ACCESS_LOG_H
+
+#include <stdio.h>
+#include <string>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include "block_queue.h"
+
+using namespace std;
+
+//访问日志的一条记录,由http_conn在响应发送完毕后填写
+struct access_record
+{
+    const char *method;
+    const char *path;
+    int status;
+    long long bytes;
+    long long latency_us;
+    const sockaddr_storage *client;
+    int reuse; //keep-alive连接上的第几个请求,从0开始
+};
+
+//按ip:port格式化地址,IPv6为[ip]:port,IPv4映射的IPv6地址按IPv4输出
+int format_addr(const sockaddr_storage *addr, char *buf, size_t len);
+
+class AccessLog
+{
+public:
+    //可选字段,按配置的顺序输出
+    enum FIELD
+    {
+        F_METHOD = 0,
+        F_PATH,
+        F_STATUS,
+        F_BYTES,
+        F_LATENCY,
+        F_CLIENT,
+        F_REUSE,
+        F_COUNT
+    };
+
+    static AccessLog *get_instance()
+    {
+        static AccessLog instance;
+        return &instance;
+    }
+
+    static void *flush_access_log_thread(void *)
+    {
+        AccessLog::get_instance()->async_write();
+        return NULL;
+    }
+
+    //sample为采样间隔,每sample个请求记录1个,0表示关闭;fields为逗号分隔的字段列表
+    bool init(const char *file_name, int sample, const char *fields, int max_queue_size = 8192);
+
+    //按线程计数采样,不加锁
+    bool sampled()
+    {
+        if (m_sample <= 0)
+            return false;
+        static __thread unsigned int counter = 0;
+        return (counter++ % m_sample) == 0;
+    }
+
+    void write(const access_record &rec);
+
+    long long dropped() { return m_dropped; }
+
+private:
+    AccessLog();
+    ~AccessLog();
+    bool parse_fields(const char *fields);
+    void async_write();
+
+private:
+    FILE *m_fp;
+    int m_sample;
+    int m_fields[F_COUNT]; //输出顺序
+    int m_field_count;
+    block_queue<string> *m_queue;
+    long long m_dropped; //队列满时丢弃的条数
+};
+
+#endif
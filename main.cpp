@@ -11,6 +11,10 @@ int main(int argc, char *argv[])
     Config config;
     config.parse_arg(argc, argv);
 
+    //CPU亲和性与NUMA节点,须在分配连接池和创建各线程之前
+    if (!Affinity::get_instance()->init(config.numa_node, config.loop_cpus, config.worker_cpus))
+        return 1;
+
     WebServer server;
 
     //初始化
@@ -22,15 +26,44 @@ int main(int argc, char *argv[])
     //日志
     server.log_write();
 
+    //访问日志
+    server.access_log(config.access_log_sample, config.access_log_fields);
+
+    //压缩缓存
+    server.compress_cache(config.compress_cache);
+
+    //I/O后端,须在线程池之前确定并发模型
+    server.io_backend(config.io_uring, config.epoll_oneshot);
+
     //数据库
     server.sql_pool();
 
     //线程池
+    server.pool_size(config.threads_min, config.threads_max, config.pool_grow_wait, config.pool_idle);
+    server.db_executor(config.db_threads);
     server.thread_pool();
 
+    //监控
+    server.metrics(config.metrics);
+
+    //路由
+    server.routes();
+
     //触发模式
     server.trig_mode();
 
+    //监听队列与每轮accept上限
+    server.listen_options(config.backlog, config.accept_batch);
+
+    //socket选项
+    server.socket_options(config.sock_opt);
+
+    //监听地址
+    server.listen_addrs(config.listen_addrs);
+
+    //热升级
+    server.upgrade(config.upgrade_sock, config.drain_timeout);
+
     //监听
     server.eventListen();
 
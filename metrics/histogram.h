@@ -0,0 +1,67 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <string.h>
+
+//HDR风格的对数-线性直方图,单位纳秒
+//每个2的幂区间再线性分为2^SUB_BITS个桶,相对误差不超过1/2^SUB_BITS
+struct latency_hist
+{
+    static const int SUB_BITS = 3;
+    static const int SUB_COUNT = 1 << SUB_BITS;
+    static const int MAX_EXP = 40; //约1100秒,更大的值计入最后一个桶
+    static const int BUCKETS = (MAX_EXP - SUB_BITS + 2) * SUB_COUNT;
+
+    long long count;
+    long long sum;
+    long long buckets[BUCKETS];
+
+    static int bucket_of(long long v)
+    {
+        if (v < SUB_COUNT)
+            return v < 0 ? 0 : (int)v;
+        int e = 63 - __builtin_clzll((unsigned long long)v);
+        if (e > MAX_EXP)
+            return BUCKETS - 1;
+        int sub = (int)((v >> (e - SUB_BITS)) & (SUB_COUNT - 1));
+        return (e - SUB_BITS + 1) * SUB_COUNT + sub;
+    }
+
+    //桶内最大值,用于估算分位数
+    static long long bucket_upper(int b)
+    {
+        if (b < SUB_COUNT)
+            return b;
+        int e = b / SUB_COUNT + SUB_BITS - 1;
+        long long sub = b % SUB_COUNT;
+        return ((SUB_COUNT + sub + 1) << (e - SUB_BITS)) - 1;
+    }
+
+    void merge(const latency_hist &other)
+    {
+        count += __atomic_load_n(&other.count, __ATOMIC_RELAXED);
+        sum += __atomic_load_n(&other.sum, __ATOMIC_RELAXED);
+        for (int i = 0; i < BUCKETS; ++i)
+            buckets[i] += __atomic_load_n(&other.buckets[i], __ATOMIC_RELAXED);
+    }
+
+    //q取值0~1
+    long long quantile(double q) const
+    {
+        if (count == 0)
+            return 0;
+        long long rank = (long long)(q * count);
+        if (rank >= count)
+            rank = count - 1;
+        long long seen = 0;
+        for (int i = 0; i < BUCKETS; ++i)
+        {
+            seen += buckets[i];
+            if (seen > rank)
+                return bucket_upper(i);
+        }
+        return bucket_upper(BUCKETS - 1);
+    }
+};
+
+#endif
@@ -0,0 +1,246 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include "metrics.h"
+
+Metrics::Metrics()
+{
+    m_enable = false;
+    m_path[0] = '\0';
+    m_thread_count = 0;
+    m_free_count = 0;
+    m_gauge_count = 0;
+    memset(&m_overflow, 0, sizeof(m_overflow));
+    pthread_key_create(&m_key, release_thread);
+}
+
+void Metrics::init(bool enable, const char *path)
+{
+    m_enable = enable;
+    strncpy(m_path, path, sizeof(m_path) - 1);
+}
+
+thread_metrics *Metrics::register_thread()
+{
+    thread_metrics *tm = NULL;
+    m_lock.lock();
+    //动态线程池中的线程会不断退出和创建,优先复用已退出线程的计数器,累计值不丢失
+    if (m_free_count > 0)
+    {
+        tm = m_free[--m_free_count];
+    }
+    else if (m_thread_count < MAX_THREADS)
+    {
+        tm = new thread_metrics();
+        m_threads[m_thread_count++] = tm;
+    }
+    else
+    {
+        tm = &m_overflow;
+    }
+    m_lock.unlock();
+    if (tm != &m_overflow)
+        pthread_setspecific(m_key, tm);
+    return tm;
+}
+
+//计数器仍计入汇总,只是不再有线程写入,之后注册的线程接着写
+void Metrics::release_thread(void *tm)
+{
+    Metrics *m = get_instance();
+    m->m_lock.lock();
+    m->m_free[m->m_free_count++] = (thread_metrics *)tm;
+    m->m_lock.unlock();
+}
+
+void Metrics::add_gauge(const char *name, const char *help, gauge_fn fn, void *arg)
+{
+    add_callback(name, help, fn, arg, false);
+}
+
+void Metrics::add_counter(const char *name, const char *help, gauge_fn fn, void *arg)
+{
+    add_callback(name, help, fn, arg, true);
+}
+
+void Metrics::add_callback(const char *name, const char *help, gauge_fn fn, void *arg, bool counter)
+{
+    m_lock.lock();
+    if (m_gauge_count < MAX_GAUGES)
+    {
+        gauge &g = m_gauges[m_gauge_count++];
+        g.name = name;
+        g.help = help;
+        g.fn = fn;
+        g.arg = arg;
+        g.counter = counter;
+    }
+    m_lock.unlock();
+}
+
+void Metrics::record_response(int status, long long bytes)
+{
+    thread_metrics *tm = local();
+    metrics_add(tm->requests);
+    metrics_add(tm->bytes_sent, bytes);
+    if (status >= thread_metrics::STATUS_MIN && status <= thread_metrics::STATUS_MAX)
+        metrics_add(tm->status[status - thread_metrics::STATUS_MIN]);
+}
+
+void Metrics::record_latency(int phase, long long start_ns, long long end_ns)
+{
+    if (start_ns <= 0)
+        return;
+    long long v = end_ns - start_ns;
+    latency_hist &h = local()->latency[phase];
+    metrics_add(h.count);
+    metrics_add(h.sum, v);
+    metrics_add(h.buckets[latency_hist::bucket_of(v)]);
+}
+
+static const char *phase_names[PHASE_COUNT] = {
+    "accept", "queue", "parse", "do_request_file", "db_queue", "do_request_db", "write", "total"};
+
+static const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+
+void Metrics::merge_latency(latency_hist *out)
+{
+    memset(out, 0, sizeof(latency_hist) * PHASE_COUNT);
+    m_lock.lock();
+    for (int i = 0; i <= m_thread_count; ++i)
+    {
+        thread_metrics *tm = i < m_thread_count ? m_threads[i] : &m_overflow;
+        for (int p = 0; p < PHASE_COUNT; ++p)
+            out[p].merge(tm->latency[p]);
+    }
+    m_lock.unlock();
+}
+
+void Metrics::dump_latency(FILE *fp)
+{
+    latency_hist *hist = new latency_hist[PHASE_COUNT];
+    merge_latency(hist);
+    fprintf(fp, "%-16s %10s %10s %10s %10s %10s %10s\n", "phase(us)", "count", "mean", "p50", "p90", "p99", "p999");
+    for (int p = 0; p < PHASE_COUNT; ++p)
+    {
+        latency_hist &h = hist[p];
+        fprintf(fp, "%-16s %10lld %10.1f", phase_names[p], h.count, h.count ? h.sum / 1000.0 / h.count : 0.0);
+        for (size_t q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); ++q)
+            fprintf(fp, " %10.1f", h.quantile(quantiles[q]) / 1000.0);
+        fprintf(fp, "\n");
+    }
+    fflush(fp);
+    delete[] hist;
+}
+
+static void append(string &out, const char *format, ...) __attribute__((format(printf, 2, 3)));
+static void append(string &out, const char *format, ...)
+{
+    char buf[256];
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+    if (n > 0)
+        out.append(buf, n < (int)sizeof(buf) ? n : sizeof(buf) - 1);
+}
+
+static void append_counter(string &out, const char *name, const char *help, long long value)
+{
+    append(out, "# HELP %s %s\n# TYPE %s counter\n%s %lld\n", name, help, name, name, value);
+}
+
+void Metrics::render(string &out)
+{
+    int cursor = 0;
+    while (render_part(out, cursor))
+        ;
+}
+
+bool Metrics::render_part(string &out, int &cursor)
+{
+    switch (cursor++)
+    {
+    case 0:
+        render_counters(out);
+        return true;
+    case 1:
+        render_latency(out);
+        return true;
+    case 2:
+        render_gauges(out);
+        return true;
+    default:
+        return false;
+    }
+}
+
+void Metrics::render_counters(string &out)
+{
+    thread_metrics sum;
+    memset(&sum, 0, sizeof(sum));
+
+    m_lock.lock();
+    int count = m_thread_count;
+    for (int i = 0; i <= count; ++i)
+    {
+        thread_metrics *tm = i < count ? m_threads[i] : &m_overflow;
+        sum.requests += __atomic_load_n(&tm->requests, __ATOMIC_RELAXED);
+        sum.bytes_sent += __atomic_load_n(&tm->bytes_sent, __ATOMIC_RELAXED);
+        sum.accepts += __atomic_load_n(&tm->accepts, __ATOMIC_RELAXED);
+        sum.accept_busy += __atomic_load_n(&tm->accept_busy, __ATOMIC_RELAXED);
+        sum.epoll_ctls += __atomic_load_n(&tm->epoll_ctls, __ATOMIC_RELAXED);
+        sum.loop_wakeups += __atomic_load_n(&tm->loop_wakeups, __ATOMIC_RELAXED);
+        sum.accept_budget += __atomic_load_n(&tm->accept_budget, __ATOMIC_RELAXED);
+        sum.accept_remote_cpu += __atomic_load_n(&tm->accept_remote_cpu, __ATOMIC_RELAXED);
+        for (int s = 0; s <= thread_metrics::STATUS_MAX - thread_metrics::STATUS_MIN; ++s)
+            sum.status[s] += __atomic_load_n(&tm->status[s], __ATOMIC_RELAXED);
+    }
+    m_lock.unlock();
+
+    append_counter(out, "tws_requests_total", "Completed HTTP responses.", sum.requests);
+    append_counter(out, "tws_bytes_sent_total", "Bytes written to clients.", sum.bytes_sent);
+    append_counter(out, "tws_accepts_total", "Accepted connections.", sum.accepts);
+    append_counter(out, "tws_accept_busy_total", "Connections rejected because MAX_FD was reached.", sum.accept_busy);
+    append_counter(out, "tws_epoll_ctl_total", "epoll_ctl calls made for client connections.", sum.epoll_ctls);
+    append_counter(out, "tws_accept_budget_exhausted_total", "Accept rounds that stopped at the per-iteration budget.", sum.accept_budget);
+    append_counter(out, "tws_accept_remote_cpu_total", "Connections whose packets arrived on a CPU outside the configured ones (--incoming-cpu 1).", sum.accept_remote_cpu);
+    append_counter(out, "tws_loop_wakeups_total", "Eventfd writes waking the event loop after a worker finished.", sum.loop_wakeups);
+
+    append(out, "# HELP tws_responses_total Completed HTTP responses by status code.\n# TYPE tws_responses_total counter\n");
+    for (int s = 0; s <= thread_metrics::STATUS_MAX - thread_metrics::STATUS_MIN; ++s)
+    {
+        if (sum.status[s])
+            append(out, "tws_responses_total{code=\"%d\"} %lld\n", s + thread_metrics::STATUS_MIN, sum.status[s]);
+    }
+}
+
+void Metrics::render_latency(string &out)
+{
+    latency_hist *hist = new latency_hist[PHASE_COUNT];
+    merge_latency(hist);
+    append(out, "# HELP tws_latency_seconds Request latency by processing phase.\n# TYPE tws_latency_seconds summary\n");
+    for (int p = 0; p < PHASE_COUNT; ++p)
+    {
+        latency_hist &h = hist[p];
+        for (size_t q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); ++q)
+            append(out, "tws_latency_seconds{phase=\"%s\",quantile=\"%g\"} %.9f\n",
+                   phase_names[p], quantiles[q], h.quantile(quantiles[q]) / 1e9);
+        append(out, "tws_latency_seconds_sum{phase=\"%s\"} %.9f\n", phase_names[p], h.sum / 1e9);
+        append(out, "tws_latency_seconds_count{phase=\"%s\"} %lld\n", phase_names[p], h.count);
+    }
+    delete[] hist;
+}
+
+void Metrics::render_gauges(string &out)
+{
+    m_lock.lock();
+    int gauge_count = m_gauge_count;
+    m_lock.unlock();
+    for (int i = 0; i < gauge_count; ++i)
+    {
+        gauge &g = m_gauges[i];
+        append(out, "# HELP %s %s\n# TYPE %s %s\n%s %lld\n", g.name, g.help, g.name, g.counter ? "counter" : "gauge",
+               g.name, g.fn(g.arg));
+    }
+}
@@ -0,0 +1,136 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <string>
+#include <stdio.h>
+#include <time.h>
+#include <pthread.h>
+#include "../lock/locker.h"
+#include "histogram.h"
+
+using namespace std;
+
+//请求处理的各个阶段
+enum LATENCY_PHASE
+{
+    PHASE_ACCEPT = 0,  //accept到收到首字节
+    PHASE_QUEUE,       //在线程池队列中等待
+    PHASE_PARSE,       //process_read解析
+    PHASE_DO_FILE,     //do_request静态文件
+    PHASE_DB_QUEUE,    //在数据库执行器队列中等待
+    PHASE_DO_DB,       //do_request数据库(登录注册)
+    PHASE_WRITE,       //响应生成后到发送完毕
+    PHASE_TOTAL,       //收到首字节到发送完毕
+    PHASE_COUNT
+};
+
+//单调时钟,vDSO实现,不陷入内核
+inline long long metrics_now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+//每个线程独占一份计数器,只有所属线程写,读取时汇总
+struct thread_metrics
+{
+    static const int STATUS_MIN = 100;
+    static const int STATUS_MAX = 599;
+
+    long long requests;   //完成的响应数
+    long long bytes_sent; //发送的字节数
+    long long accepts;    //接受的连接数
+    long long accept_busy; //连接数达到上限被拒绝
+    long long epoll_ctls;  //epoll_ctl调用次数
+    long long loop_wakeups; //工作线程唤醒事件循环的次数
+    long long accept_budget; //一轮accept用完预算的次数
+    long long accept_remote_cpu; //收包CPU不在配置的CPU中的连接数
+    long long status[STATUS_MAX - STATUS_MIN + 1];
+    latency_hist latency[PHASE_COUNT];
+} __attribute__((aligned(64)));
+
+//只由所属线程修改,不需要原子的读-改-写,只保证读取方不会读到撕裂的值
+inline void metrics_add(long long &counter, long long n = 1)
+{
+    __atomic_store_n(&counter, __atomic_load_n(&counter, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+}
+
+class Metrics
+{
+public:
+    static const int MAX_THREADS = 256;
+    static const int MAX_GAUGES = 32;
+
+    //读取时回调的瞬时值,如连接数、队列长度
+    typedef long long (*gauge_fn)(void *arg);
+
+    static Metrics *get_instance()
+    {
+        static Metrics instance;
+        return &instance;
+    }
+
+    //当前线程的计数器,首次调用时注册,线程退出后交给新线程继续累加
+    static thread_metrics *local()
+    {
+        static __thread thread_metrics *tls = NULL;
+        if (!tls)
+            tls = get_instance()->register_thread();
+        return tls;
+    }
+
+    void init(bool enable, const char *path);
+    bool enabled() { return m_enable; }
+    const char *path() { return m_path; }
+
+    void add_gauge(const char *name, const char *help, gauge_fn fn, void *arg);
+    //由外部维护的累计值,如内核统计,同样在读取时回调
+    void add_counter(const char *name, const char *help, gauge_fn fn, void *arg);
+    void record_response(int status, long long bytes);
+    //start_ns为0表示该阶段没有开始时间,不记录
+    void record_latency(int phase, long long start_ns, long long end_ns);
+
+    //SIGUSR1时输出各阶段分位数
+    void dump_latency(FILE *fp);
+
+    //以Prometheus文本格式输出
+    void render(string &out);
+    //分段输出,cursor从0开始,返回false表示没有更多内容
+    bool render_part(string &out, int &cursor);
+
+private:
+    Metrics();
+    ~Metrics() {}
+    thread_metrics *register_thread();
+    static void release_thread(void *tm);
+    void add_callback(const char *name, const char *help, gauge_fn fn, void *arg, bool counter);
+    void merge_latency(latency_hist *out);
+    void render_counters(string &out);
+    void render_latency(string &out);
+    void render_gauges(string &out);
+
+private:
+    struct gauge
+    {
+        const char *name;
+        const char *help;
+        gauge_fn fn;
+        void *arg;
+        bool counter;
+    };
+
+    bool m_enable;
+    char m_path[64];
+    locker m_lock;
+    thread_metrics *m_threads[MAX_THREADS];
+    int m_thread_count;
+    thread_metrics *m_free[MAX_THREADS]; //已退出线程留下的计数器
+    int m_free_count;
+    pthread_key_t m_key;       //线程退出时归还计数器
+    thread_metrics m_overflow; //同时存活的线程数超过上限时共用,计数可能不精确
+    gauge m_gauges[MAX_GAUGES];
+    int m_gauge_count;
+};
+
+#endif
@@ -0,0 +1,833 @@
+/*************************************************************
+*基于epoll的多线程HTTP压测工具
+*支持keep-alive、pipeline深度、按权重混合的url、
+*开环恒定速率模式以及p50/p99/p999延迟统计,
+*新连接从connect到收到首字节的延迟,可选TCP Fast Open
+**************************************************************/
+
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include <deque>
+
+#include "../../metrics/histogram.h"
+
+using namespace std;
+
+static const int READ_CHUNK = 16384;
+static const int MAX_EVENTS = 512;
+
+//一种请求模板,按权重随机选取
+struct request_tpl
+{
+    int weight;
+    string method;
+    string path;
+    string body;
+    string raw; //预先拼好的完整请求报文
+};
+
+struct options
+{
+    string host;
+    int port;
+    int conns;
+    int threads;
+    int duration;   //秒
+    int depth;      //pipeline深度
+    double rate;    //开环模式总请求速率,0为闭环
+    int keepalive;
+    int timeout_ms;
+    int fastopen;   //TCP_FASTOPEN_CONNECT,请求随SYN发出
+    const char *mix_file;
+    vector<request_tpl> mix;
+    int total_weight;
+};
+
+static options opt;
+static struct sockaddr_in server_addr;
+
+static long long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+enum RESP_STATE
+{
+    RESP_HEADER = 0,
+    RESP_BODY,
+    RESP_CHUNK_SIZE,
+    RESP_CHUNK_DATA,
+    RESP_CHUNK_CRLF,
+    RESP_TRAILER
+};
+
+struct conn
+{
+    int fd;
+    bool connected;
+    long long opened_ns;
+    bool first_byte; //是否已收到该连接的第一个字节
+    int sent; //该连接上已发出的请求数
+    string out;
+    size_t out_off;
+    string in;
+    size_t in_off;
+    deque<long long> inflight; //每个未完成请求的计划发送时间
+
+    RESP_STATE state;
+    long long body_left;
+    bool close_after;
+    int status;
+};
+
+struct worker
+{
+    pthread_t tid;
+    int id;
+    int epfd;
+    int tfd; //开环模式的发送定时器
+    vector<conn> conns;
+    unsigned long long rng;
+
+    //开环模式
+    double rate;
+    long long issued;
+    deque<long long> backlog; //已到计划时间但没有空闲连接的请求
+    size_t next_conn;
+
+    //统计
+    latency_hist hist;
+    latency_hist first_byte; //connect到首字节
+    long long completed;
+    long long bytes;
+    long long status_class[6];
+    long long err_connect;
+    long long err_read;
+    long long err_timeout;
+};
+
+static unsigned long long next_rand(worker *w)
+{
+    w->rng ^= w->rng << 13;
+    w->rng ^= w->rng >> 7;
+    w->rng ^= w->rng << 17;
+    return w->rng;
+}
+
+static const request_tpl &pick_request(worker *w)
+{
+    if (opt.mix.size() == 1)
+        return opt.mix[0];
+    int r = next_rand(w) % opt.total_weight;
+    for (size_t i = 0; i < opt.mix.size(); ++i)
+    {
+        r -= opt.mix[i].weight;
+        if (r < 0)
+            return opt.mix[i];
+    }
+    return opt.mix.back();
+}
+
+static void build_requests()
+{
+    char host[128];
+    snprintf(host, sizeof(host), "%s:%d", opt.host.c_str(), opt.port);
+    opt.total_weight = 0;
+    for (size_t i = 0; i < opt.mix.size(); ++i)
+    {
+        request_tpl &t = opt.mix[i];
+        string &r = t.raw;
+        r = t.method + " " + t.path + " HTTP/1.1\r\nHost: " + host + "\r\n";
+        r += opt.keepalive ? "Connection: keep-alive\r\n" : "Connection: close\r\n";
+        if (!t.body.empty())
+        {
+            char len[64];
+            snprintf(len, sizeof(len), "Content-Length: %zu\r\n", t.body.size());
+            r += "Content-Type: application/x-www-form-urlencoded\r\n";
+            r += len;
+        }
+        r += "\r\n";
+        r += t.body;
+        opt.total_weight += t.weight;
+    }
+}
+
+//混合文件每行: 权重 方法 路径 [请求体]
+static bool load_mix(const char *file)
+{
+    FILE *fp = fopen(file, "r");
+    if (!fp)
+    {
+        perror(file);
+        return false;
+    }
+    char line[4096];
+    while (fgets(line, sizeof(line), fp))
+    {
+        line[strcspn(line, "\r\n")] = '\0';
+        char *p = line + strspn(line, " \t");
+        if (*p == '#' || *p == '\0')
+            continue;
+        char method[16], path[2048];
+        int weight, consumed = 0;
+        if (sscanf(p, "%d %15s %2047s %n", &weight, method, path, &consumed) < 3 || weight <= 0)
+        {
+            fprintf(stderr, "bad mix line: %s\n", line);
+            fclose(fp);
+            return false;
+        }
+        request_tpl t;
+        t.weight = weight;
+        t.method = method;
+        t.path = path;
+        if (consumed > 0)
+            t.body = p + consumed;
+        opt.mix.push_back(t);
+    }
+    fclose(fp);
+    return !opt.mix.empty();
+}
+
+static void conn_reset(conn *c)
+{
+    c->fd = -1;
+    c->connected = false;
+    c->opened_ns = 0;
+    c->first_byte = false;
+    c->sent = 0;
+    c->out.clear();
+    c->out_off = 0;
+    c->in.clear();
+    c->in_off = 0;
+    c->inflight.clear();
+    c->state = RESP_HEADER;
+    c->body_left = 0;
+    c->close_after = false;
+    c->status = 0;
+}
+
+static bool conn_open(worker *w, conn *c)
+{
+    conn_reset(c);
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return false;
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    //connect立即返回,第一次send时连同数据发出SYN;没有cookie时退化为普通握手
+    if (opt.fastopen)
+        setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, &one, sizeof(one));
+    if (connect(fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0 && errno != EINPROGRESS)
+    {
+        close(fd);
+        w->err_connect++;
+        return false;
+    }
+    c->fd = fd;
+    c->opened_ns = now_ns();
+    //边缘触发,读写事件只注册一次
+    epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLET | EPOLLRDHUP;
+    ev.data.ptr = c;
+    epoll_ctl(w->epfd, EPOLL_CTL_ADD, fd, &ev);
+    return true;
+}
+
+//未完成的请求计为错误,然后重连
+static void conn_close(worker *w, conn *c, long long *err_counter)
+{
+    if (c->fd >= 0)
+    {
+        epoll_ctl(w->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+        close(c->fd);
+    }
+    if (err_counter)
+        *err_counter += c->inflight.size();
+    //开环模式下未完成的请求放回积压队列,保持计划发送时间
+    if (opt.rate > 0)
+    {
+        for (size_t i = 0; i < c->inflight.size(); ++i)
+            w->backlog.push_front(c->inflight[i]);
+    }
+    c->inflight.clear();
+    c->fd = -1;
+}
+
+static bool conn_flush(worker *w, conn *c)
+{
+    while (c->connected && c->out_off < c->out.size())
+    {
+        ssize_t n = send(c->fd, c->out.data() + c->out_off, c->out.size() - c->out_off, MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            //Fast Open没有cookie时数据在握手完成后才发出
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINPROGRESS)
+                return true;
+            conn_close(w, c, &w->err_read);
+            return false;
+        }
+        c->out_off += n;
+    }
+    if (c->out_off == c->out.size())
+    {
+        c->out.clear();
+        c->out_off = 0;
+    }
+    return true;
+}
+
+static void send_request(worker *w, conn *c, long long start)
+{
+    c->out += pick_request(w).raw;
+    c->inflight.push_back(start);
+    c->sent++;
+}
+
+//连接空闲时按照模式补充请求
+static void fill_conn(worker *w, conn *c, long long now)
+{
+    if (c->fd < 0 || !c->connected)
+        return;
+    //短连接每个连接只发一个请求
+    int depth = opt.keepalive ? opt.depth : 1;
+    while ((int)c->inflight.size() < depth && (opt.keepalive || c->sent == 0))
+    {
+        if (opt.rate > 0)
+        {
+            if (w->backlog.empty())
+                break;
+            send_request(w, c, w->backlog.front());
+            w->backlog.pop_front();
+        }
+        else
+        {
+            send_request(w, c, now);
+        }
+    }
+    conn_flush(w, c);
+}
+
+static void complete_response(worker *w, conn *c, long long now)
+{
+    if (!c->inflight.empty())
+    {
+        long long start = c->inflight.front();
+        c->inflight.pop_front();
+        long long v = now - start;
+        w->hist.count++;
+        w->hist.sum += v;
+        w->hist.buckets[latency_hist::bucket_of(v)]++;
+    }
+    w->completed++;
+    int cls = c->status / 100;
+    w->status_class[cls >= 1 && cls <= 5 ? cls : 0]++;
+    c->state = RESP_HEADER;
+    c->status = 0;
+}
+
+//解析响应头,返回false表示格式错误
+static bool parse_header(conn *c, const char *begin, const char *end)
+{
+    if (end - begin < 12 || strncmp(begin, "HTTP/1.", 7) != 0)
+        return false;
+    c->status = atoi(begin + 9);
+    c->body_left = 0;
+    c->close_after = strncmp(begin, "HTTP/1.0", 8) == 0;
+    bool chunked = false;
+    const char *line = (const char *)memchr(begin, '\n', end - begin);
+    while (line && line + 1 < end)
+    {
+        line++;
+        if (strncasecmp(line, "Content-Length:", 15) == 0)
+            c->body_left = atoll(line + 15);
+        else if (strncasecmp(line, "Transfer-Encoding:", 18) == 0)
+        {
+            const char *v = line + 18;
+            v += strspn(v, " \t");
+            chunked = strncasecmp(v, "chunked", 7) == 0;
+        }
+        else if (strncasecmp(line, "Connection:", 11) == 0)
+        {
+            const char *v = line + 11;
+            v += strspn(v, " \t");
+            if (strncasecmp(v, "close", 5) == 0)
+                c->close_after = true;
+            else if (strncasecmp(v, "keep-alive", 10) == 0)
+                c->close_after = false;
+        }
+        line = (const char *)memchr(line, '\n', end - line);
+    }
+    //1xx中间响应没有响应体,不计入结果
+    if (c->status >= 100 && c->status < 200)
+        c->state = RESP_HEADER;
+    else
+        c->state = chunked ? RESP_CHUNK_SIZE : RESP_BODY;
+    return true;
+}
+
+//返回false表示连接已关闭
+static bool parse_responses(worker *w, conn *c, long long now)
+{
+    while (c->in_off < c->in.size())
+    {
+        const char *data = c->in.data() + c->in_off;
+        size_t avail = c->in.size() - c->in_off;
+        if (c->state == RESP_HEADER)
+        {
+            const char *end = (const char *)memmem(data, avail, "\r\n\r\n", 4);
+            if (!end)
+                break;
+            if (!parse_header(c, data, end + 2))
+            {
+                conn_close(w, c, &w->err_read);
+                return false;
+            }
+            c->in_off += end + 4 - data;
+            if (c->state == RESP_BODY && c->body_left == 0)
+                complete_response(w, c, now);
+            else if (c->state == RESP_HEADER)
+                continue;
+        }
+        else if (c->state == RESP_BODY || c->state == RESP_CHUNK_DATA)
+        {
+            size_t n = avail < (size_t)c->body_left ? avail : c->body_left;
+            c->in_off += n;
+            c->body_left -= n;
+            if (c->body_left == 0)
+            {
+                if (c->state == RESP_BODY)
+                    complete_response(w, c, now);
+                else
+                    c->state = RESP_CHUNK_CRLF;
+            }
+        }
+        else if (c->state == RESP_CHUNK_SIZE)
+        {
+            const char *eol = (const char *)memmem(data, avail, "\r\n", 2);
+            if (!eol)
+                break;
+            c->body_left = strtoll(data, NULL, 16);
+            c->in_off += eol + 2 - data;
+            c->state = c->body_left == 0 ? RESP_TRAILER : RESP_CHUNK_DATA;
+        }
+        else if (c->state == RESP_CHUNK_CRLF)
+        {
+            if (avail < 2)
+                break;
+            c->in_off += 2;
+            c->state = RESP_CHUNK_SIZE;
+        }
+        else if (c->state == RESP_TRAILER)
+        {
+            const char *eol = (const char *)memmem(data, avail, "\r\n", 2);
+            if (!eol)
+                break;
+            c->in_off += eol + 2 - data;
+            //空行表示结束
+            if (eol == data)
+                complete_response(w, c, now);
+        }
+
+        if (c->state == RESP_HEADER && c->status == 0 && (c->close_after || !opt.keepalive) && c->inflight.empty())
+        {
+            conn_close(w, c, NULL);
+            return false;
+        }
+    }
+    if (c->in_off == c->in.size())
+    {
+        c->in.clear();
+        c->in_off = 0;
+    }
+    else if (c->in_off > READ_CHUNK)
+    {
+        c->in.erase(0, c->in_off);
+        c->in_off = 0;
+    }
+    //服务器要求关闭但仍有pipeline中的请求,这些请求不会被处理
+    if (c->close_after && c->state == RESP_HEADER && !c->inflight.empty())
+    {
+        conn_close(w, c, &w->err_read);
+        return false;
+    }
+    return true;
+}
+
+static void handle_event(worker *w, conn *c, unsigned int events, long long now)
+{
+    if (!c->connected)
+    {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+        if (err != 0 || (events & (EPOLLERR | EPOLLHUP)))
+        {
+            conn_close(w, c, NULL);
+            w->err_connect++;
+            return;
+        }
+        if (!(events & EPOLLOUT))
+            return;
+        c->connected = true;
+        fill_conn(w, c, now);
+        if (c->fd < 0)
+            return;
+    }
+
+    if (events & EPOLLOUT)
+    {
+        if (!conn_flush(w, c))
+            return;
+    }
+
+    if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+    {
+        char buf[READ_CHUNK];
+        while (true)
+        {
+            ssize_t n = recv(c->fd, buf, sizeof(buf), 0);
+            if (n > 0)
+            {
+                if (!c->first_byte)
+                {
+                    c->first_byte = true;
+                    long long v = now - c->opened_ns;
+                    w->first_byte.count++;
+                    w->first_byte.sum += v;
+                    w->first_byte.buckets[latency_hist::bucket_of(v)]++;
+                }
+                w->bytes += n;
+                c->in.append(buf, n);
+                continue;
+            }
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                break;
+            //对端关闭或出错
+            parse_responses(w, c, now);
+            if (c->fd >= 0)
+                conn_close(w, c, &w->err_read);
+            return;
+        }
+        if (!parse_responses(w, c, now))
+            return;
+        fill_conn(w, c, now);
+    }
+}
+
+//开环模式:按计划时间生成请求,分配给有空余pipeline的连接
+static void schedule_open_loop(worker *w, long long start, long long now)
+{
+    //计划时间不晚于当前时间的请求都已到期
+    long long due = (long long)((now - start) / 1e9 * w->rate) + 1;
+    while (w->issued < due)
+    {
+        long long t = start + (long long)(w->issued / w->rate * 1e9);
+        w->backlog.push_back(t);
+        w->issued++;
+    }
+    size_t n = w->conns.size();
+    for (size_t i = 0; i < n && !w->backlog.empty(); ++i)
+    {
+        conn *c = &w->conns[(w->next_conn + i) % n];
+        fill_conn(w, c, now);
+    }
+    w->next_conn = (w->next_conn + 1) % n;
+}
+
+static void check_timeouts(worker *w, long long now)
+{
+    long long limit = (long long)opt.timeout_ms * 1000000LL;
+    for (size_t i = 0; i < w->conns.size(); ++i)
+    {
+        conn *c = &w->conns[i];
+        if (c->fd < 0)
+            continue;
+        if (!c->connected && now - c->opened_ns > limit)
+        {
+            conn_close(w, c, NULL);
+            w->err_connect++;
+        }
+        else if (!c->inflight.empty() && now - c->inflight.front() > limit)
+        {
+            conn_close(w, c, &w->err_timeout);
+        }
+    }
+}
+
+static void *worker_main(void *arg)
+{
+    worker *w = (worker *)arg;
+    w->epfd = epoll_create1(EPOLL_CLOEXEC);
+    //定时器精确到纳秒,避免epoll_wait毫秒超时带来的误差和空转
+    w->tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    epoll_event tev;
+    tev.events = EPOLLIN;
+    tev.data.ptr = NULL;
+    epoll_ctl(w->epfd, EPOLL_CTL_ADD, w->tfd, &tev);
+    for (size_t i = 0; i < w->conns.size(); ++i)
+        conn_open(w, &w->conns[i]);
+
+    epoll_event events[MAX_EVENTS];
+    long long start = now_ns();
+    long long end = start + opt.duration * 1000000000LL;
+    long long last_check = start;
+    while (true)
+    {
+        long long now = now_ns();
+        if (now >= end)
+            break;
+        if (w->rate > 0)
+        {
+            long long next = start + (long long)(w->issued / w->rate * 1e9);
+            struct itimerspec its;
+            memset(&its, 0, sizeof(its));
+            its.it_value.tv_sec = next / 1000000000LL;
+            its.it_value.tv_nsec = next % 1000000000LL;
+            timerfd_settime(w->tfd, TFD_TIMER_ABSTIME, &its, NULL);
+        }
+        int n = epoll_wait(w->epfd, events, MAX_EVENTS, 100);
+        now = now_ns();
+        for (int i = 0; i < n; ++i)
+        {
+            conn *c = (conn *)events[i].data.ptr;
+            if (!c)
+            {
+                unsigned long long expirations;
+                if (read(w->tfd, &expirations, sizeof(expirations)) < 0)
+                    continue;
+            }
+            else if (c->fd >= 0)
+                handle_event(w, c, events[i].events, now);
+        }
+        if (w->rate > 0)
+            schedule_open_loop(w, start, now);
+        if (now - last_check > 100000000LL)
+        {
+            check_timeouts(w, now);
+            last_check = now;
+        }
+        //补上被关闭的连接
+        for (size_t i = 0; i < w->conns.size(); ++i)
+        {
+            if (w->conns[i].fd < 0)
+                conn_open(w, &w->conns[i]);
+        }
+    }
+    for (size_t i = 0; i < w->conns.size(); ++i)
+    {
+        if (w->conns[i].fd >= 0)
+            close(w->conns[i].fd);
+    }
+    close(w->tfd);
+    close(w->epfd);
+    return NULL;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [options] http://host:port/path\n"
+            "  -c conns      total connections (default 100)\n"
+            "  -t threads    worker threads (default 4)\n"
+            "  -d seconds    test duration (default 10)\n"
+            "  -p depth      pipelined requests per connection (default 1)\n"
+            "  -r rate       open-loop mode, total requests per second (default 0, closed loop)\n"
+            "  -k 0|1        keep-alive (default 1); 0 opens a new connection per request\n"
+            "  -f mixfile    weighted url mix, lines of: weight METHOD path [body]\n"
+            "  -T ms         per-request timeout (default 5000)\n"
+            "  -F            TCP Fast Open (needs net.ipv4.tcp_fastopen with bit 1 on the client)\n",
+            prog);
+}
+
+static bool parse_url(const char *url, string &path)
+{
+    if (strncmp(url, "http://", 7) != 0)
+        return false;
+    const char *p = url + 7;
+    const char *slash = strchr(p, '/');
+    string hostport = slash ? string(p, slash - p) : string(p);
+    path = slash ? slash : "/";
+    size_t colon = hostport.rfind(':');
+    opt.port = 80;
+    if (colon != string::npos)
+    {
+        opt.port = atoi(hostport.c_str() + colon + 1);
+        hostport.erase(colon);
+    }
+    opt.host = hostport;
+
+    struct addrinfo hints, *res = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(opt.host.c_str(), NULL, &hints, &res) != 0 || !res)
+        return false;
+    server_addr = *(struct sockaddr_in *)res->ai_addr;
+    server_addr.sin_port = htons(opt.port);
+    freeaddrinfo(res);
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    opt.conns = 100;
+    opt.threads = 4;
+    opt.duration = 10;
+    opt.depth = 1;
+    opt.rate = 0;
+    opt.keepalive = 1;
+    opt.timeout_ms = 5000;
+    opt.fastopen = 0;
+    opt.mix_file = NULL;
+
+    int c;
+    while ((c = getopt(argc, argv, "c:t:d:p:r:k:f:T:Fh")) != -1)
+    {
+        switch (c)
+        {
+        case 'c':
+            opt.conns = atoi(optarg);
+            break;
+        case 't':
+            opt.threads = atoi(optarg);
+            break;
+        case 'd':
+            opt.duration = atoi(optarg);
+            break;
+        case 'p':
+            opt.depth = atoi(optarg);
+            break;
+        case 'r':
+            opt.rate = atof(optarg);
+            break;
+        case 'k':
+            opt.keepalive = atoi(optarg);
+            break;
+        case 'f':
+            opt.mix_file = optarg;
+            break;
+        case 'T':
+            opt.timeout_ms = atoi(optarg);
+            break;
+        case 'F':
+            opt.fastopen = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    string path;
+    if (optind >= argc || !parse_url(argv[optind], path))
+    {
+        usage(argv[0]);
+        return 2;
+    }
+    if (opt.conns <= 0 || opt.threads <= 0 || opt.depth <= 0 || opt.duration <= 0)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+    if (opt.threads > opt.conns)
+        opt.threads = opt.conns;
+
+    if (opt.mix_file)
+    {
+        if (!load_mix(opt.mix_file))
+            return 2;
+    }
+    else
+    {
+        request_tpl t;
+        t.weight = 1;
+        t.method = "GET";
+        t.path = path;
+        opt.mix.push_back(t);
+    }
+    build_requests();
+    signal(SIGPIPE, SIG_IGN);
+
+    printf("loadgen: %s:%d, %d connections, %d threads, %ds, depth %d, keep-alive %s, %s\n",
+           opt.host.c_str(), opt.port, opt.conns, opt.threads, opt.duration, opt.depth,
+           opt.keepalive ? "on" : "off", opt.rate > 0 ? "open loop" : "closed loop");
+
+    vector<worker *> workers(opt.threads);
+    for (int i = 0; i < opt.threads; ++i)
+    {
+        worker *w = new worker();
+        w->id = i;
+        w->rng = 0x9E3779B97F4A7C15ULL * (i + 1);
+        int n = opt.conns / opt.threads + (i < opt.conns % opt.threads ? 1 : 0);
+        w->conns.resize(n);
+        for (int j = 0; j < n; ++j)
+            conn_reset(&w->conns[j]);
+        w->rate = opt.rate / opt.threads;
+        workers[i] = w;
+    }
+
+    long long start = now_ns();
+    for (int i = 0; i < opt.threads; ++i)
+        pthread_create(&workers[i]->tid, NULL, worker_main, workers[i]);
+
+    latency_hist *total = new latency_hist();
+    latency_hist *first = new latency_hist();
+    long long completed = 0, bytes = 0, err_connect = 0, err_read = 0, err_timeout = 0;
+    long long status_class[6] = {0};
+    for (int i = 0; i < opt.threads; ++i)
+    {
+        worker *w = workers[i];
+        pthread_join(w->tid, NULL);
+        total->merge(w->hist);
+        first->merge(w->first_byte);
+        completed += w->completed;
+        bytes += w->bytes;
+        err_connect += w->err_connect;
+        err_read += w->err_read;
+        err_timeout += w->err_timeout;
+        for (int s = 0; s < 6; ++s)
+            status_class[s] += w->status_class[s];
+        delete w;
+    }
+    double elapsed = (now_ns() - start) / 1e9;
+
+    double rps = completed / elapsed;
+    double mean_us = total->count ? total->sum / 1000.0 / total->count : 0;
+    printf("requests: %lld in %.2fs, %.1f req/s, %.2f MB/s\n", completed, elapsed, rps, bytes / elapsed / 1048576.0);
+    printf("status: 2xx %lld, 3xx %lld, 4xx %lld, 5xx %lld, other %lld\n",
+           status_class[2], status_class[3], status_class[4], status_class[5], status_class[0] + status_class[1]);
+    printf("errors: connect %lld, read %lld, timeout %lld\n", err_connect, err_read, err_timeout);
+    printf("latency(us): mean %.1f, p50 %.1f, p90 %.1f, p99 %.1f, p999 %.1f\n", mean_us,
+           total->quantile(0.5) / 1000.0, total->quantile(0.9) / 1000.0,
+           total->quantile(0.99) / 1000.0, total->quantile(0.999) / 1000.0);
+    printf("first byte(us): %lld connections, p50 %.1f, p90 %.1f, p99 %.1f\n", first->count,
+           first->quantile(0.5) / 1000.0, first->quantile(0.9) / 1000.0, first->quantile(0.99) / 1000.0);
+    //供脚本解析的单行结果
+    printf("RESULT requests=%lld rps=%.1f mbps=%.2f errors=%lld non2xx=%lld mean_us=%.1f p50_us=%.1f p90_us=%.1f p99_us=%.1f p999_us=%.1f fb_p50_us=%.1f fb_p99_us=%.1f\n",
+           completed, rps, bytes / elapsed / 1048576.0, err_connect + err_read + err_timeout,
+           status_class[0] + status_class[1] + status_class[3] + status_class[4] + status_class[5], mean_us,
+           total->quantile(0.5) / 1000.0, total->quantile(0.9) / 1000.0,
+           total->quantile(0.99) / 1000.0, total->quantile(0.999) / 1000.0,
+           first->quantile(0.5) / 1000.0, first->quantile(0.99) / 1000.0);
+    delete total;
+    delete first;
+    return completed > 0 ? 0 : 1;
+}
@@ -0,0 +1,167 @@
+#!/bin/bash
+#端到端性能回归测试
+#编译server和loadgen,在回环地址上依次以各种日志方式、-m触发模式、-a并发模型启动server,
+#用loadgen压测并记录吞吐量、延迟分位数、CPU和RSS,最后与基线比较
+
+set -u
+
+REPO=$(cd "$(dirname "$0")/.." && pwd)
+PORT=9106
+DURATION=10
+CONNS=200
+THREADS=4
+MIX=""
+RESULTS="$REPO/test_presure/perf_results.csv"
+BASELINE="$REPO/test_presure/perf_baseline.csv"
+THRESHOLD=10
+SAVE_BASELINE=0
+LOG_MODES="off sync async"
+TRIG_MODES="0 1 2 3"
+ACTOR_MODELS="0 1"
+SERVER_ARGS=""
+
+usage()
+{
+    cat <<EOF
+usage: $0 [options]
+  -p port       server port (default $PORT)
+  -d seconds    load duration per run (default $DURATION)
+  -c conns      loadgen connections (default $CONNS)
+  -t threads    loadgen threads (default $THREADS)
+  -f mixfile    loadgen url mix (default: GET /)
+  -o file       results csv (default test_presure/perf_results.csv)
+  -b file       baseline csv (default test_presure/perf_baseline.csv)
+  -T percent    regression threshold for throughput and p99 (default $THRESHOLD)
+  -l modes      log modes to run, any of "off sync async" (default all)
+  -m modes      trigger modes to run (default "0 1 2 3")
+  -a models     actor models to run (default "0 1")
+  -x args       extra server arguments
+  -s            save this run as the new baseline
+EOF
+    exit 2
+}
+
+while getopts "p:d:c:t:f:o:b:T:l:m:a:x:sh" opt; do
+    case $opt in
+    p) PORT=$OPTARG ;;
+    d) DURATION=$OPTARG ;;
+    c) CONNS=$OPTARG ;;
+    t) THREADS=$OPTARG ;;
+    f) MIX=$OPTARG ;;
+    o) RESULTS=$OPTARG ;;
+    b) BASELINE=$OPTARG ;;
+    T) THRESHOLD=$OPTARG ;;
+    l) LOG_MODES=$OPTARG ;;
+    m) TRIG_MODES=$OPTARG ;;
+    a) ACTOR_MODELS=$OPTARG ;;
+    x) SERVER_ARGS=$OPTARG ;;
+    s) SAVE_BASELINE=1 ;;
+    *) usage ;;
+    esac
+done
+
+echo "== build"
+build_out=$(make -C "$REPO" server DEBUG=0 2>&1) || { echo "$build_out"; echo "server build failed"; exit 1; }
+build_out=$(make -C "$REPO" loadgen 2>&1) || { echo "$build_out"; echo "loadgen build failed"; exit 1; }
+
+#server以当前目录下的root为网站根目录,日志也写在当前目录
+WORKDIR=$(mktemp -d /tmp/tws_perf.XXXXXX)
+ln -s "$REPO/root" "$WORKDIR/root"
+trap 'rm -rf "$WORKDIR"' EXIT
+
+HZ=$(getconf CLK_TCK)
+LOADGEN_ARGS="-c $CONNS -t $THREADS -d $DURATION"
+[ -n "$MIX" ] && LOADGEN_ARGS="$LOADGEN_ARGS -f $MIX"
+
+cpu_ticks()
+{
+    awk '{print $14 + $15}' "/proc/$1/stat" 2>/dev/null || echo 0
+}
+
+wait_port()
+{
+    for _ in $(seq 50); do
+        (exec 3<>"/dev/tcp/127.0.0.1/$PORT") 2>/dev/null && return 0
+        sleep 0.1
+    done
+    return 1
+}
+
+echo "log,trig,actor,rps,mbps,errors,non2xx,mean_us,p50_us,p90_us,p99_us,p999_us,cpu_pct,rss_kb" > "$RESULTS"
+
+for log in $LOG_MODES; do
+    case $log in
+    off) log_args="-c 1" ;;
+    sync) log_args="-c 0 -l 0" ;;
+    async) log_args="-c 0 -l 1" ;;
+    *) echo "unknown log mode $log"; exit 2 ;;
+    esac
+    for trig in $TRIG_MODES; do
+        for actor in $ACTOR_MODELS; do
+            rm -f "$WORKDIR"/*ServerLog*
+            (cd "$WORKDIR" && exec "$REPO/server" -p "$PORT" -m "$trig" -a "$actor" $log_args $SERVER_ARGS >"$WORKDIR/server.out" 2>&1) &
+            pid=$!
+            if ! wait_port; then
+                echo "server did not start: log=$log -m $trig -a $actor"
+                kill -9 "$pid" 2>/dev/null
+                wait "$pid" 2>/dev/null
+                continue
+            fi
+
+            t0=$(cpu_ticks "$pid")
+            out=$("$REPO/test_presure/loadgen/loadgen" $LOADGEN_ARGS "http://127.0.0.1:$PORT/" 2>&1)
+            t1=$(cpu_ticks "$pid")
+            rss=$(awk '/VmHWM/ {print $2}' "/proc/$pid/status" 2>/dev/null)
+            kill -TERM "$pid" 2>/dev/null
+            sleep 0.2
+            kill -9 "$pid" 2>/dev/null
+            wait "$pid" 2>/dev/null
+
+            line=$(echo "$out" | grep '^RESULT')
+            if [ -z "$line" ]; then
+                echo "loadgen failed: log=$log -m $trig -a $actor"
+                echo "$out"
+                continue
+            fi
+            get() { echo "$line" | tr ' ' '\n' | awk -F= -v k="$1" '$1 == k {print $2}'; }
+            cpu=$(awk -v a="$t0" -v b="$t1" -v hz="$HZ" -v d="$DURATION" 'BEGIN {printf "%.1f", (b - a) / hz / d * 100}')
+            row="$log,$trig,$actor,$(get rps),$(get mbps),$(get errors),$(get non2xx),$(get mean_us),$(get p50_us),$(get p90_us),$(get p99_us),$(get p999_us),$cpu,${rss:-0}"
+            echo "$row" >> "$RESULTS"
+            printf "%-6s -m %s -a %s  %10s req/s  p99 %8s us  cpu %6s%%  rss %s kB\n" \
+                "$log" "$trig" "$actor" "$(get rps)" "$(get p99_us)" "$cpu" "${rss:-0}"
+        done
+    done
+done
+
+echo "== results: $RESULTS"
+
+if [ "$SAVE_BASELINE" = 1 ]; then
+    cp "$RESULTS" "$BASELINE"
+    echo "== saved baseline: $BASELINE"
+    exit 0
+fi
+
+if [ ! -f "$BASELINE" ]; then
+    echo "== no baseline at $BASELINE, run with -s to create one"
+    exit 0
+fi
+
+#以log,trig,actor为键比较吞吐量和p99,超过阈值视为退化
+echo "== compare with baseline: $BASELINE (threshold ${THRESHOLD}%)"
+awk -F, -v th="$THRESHOLD" '
+    FNR == 1 { next }
+    NR == FNR { rps[$1","$2","$3] = $4; p99[$1","$2","$3] = $11; next }
+    {
+        key = $1","$2","$3
+        if (!(key in rps)) { printf "%-14s  new\n", key; next }
+        drps = rps[key] > 0 ? ($4 - rps[key]) / rps[key] * 100 : 0
+        dp99 = p99[key] > 0 ? ($11 - p99[key]) / p99[key] * 100 : 0
+        flag = ""
+        if (drps < -th || dp99 > th) { flag = "  REGRESSION"; bad++ }
+        printf "%-14s  rps %10.1f -> %10.1f (%+6.1f%%)  p99 %9.1f -> %9.1f us (%+6.1f%%)%s\n", key, rps[key], $4, drps, p99[key], $11, dp99, flag
+    }
+    END { exit bad > 0 }
+' "$BASELINE" "$RESULTS"
+status=$?
+[ $status -ne 0 ] && echo "== regressions found"
+exit $status
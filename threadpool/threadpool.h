@@ -5,60 +5,169 @@
 #include <cstdio>
 #include <exception>
 #include <pthread.h>
+#include <sched.h>
+#include <time.h>
 #include "../lock/locker.h"
 #include "../CGImysql/sql_connection_pool.h"
+#include "../metrics/metrics.h"
+#include "../trace/trace.h"
+#include "../affinity/affinity.h"
+
+//调用线程已消耗的CPU时间,用于估计工作线程阻塞的比例
+static inline long long thread_cpu_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
 
 template <typename T>
 class threadpool
 {
 public:
     /*thread_number是线程池中线程的数量，max_requests是请求队列中最多允许的、等待处理的请求的数量*/
-    threadpool(int actor_model, connection_pool *connPool, int thread_number = 8, int max_request = 10000);
+    /*db_executor为true时作为数据库执行器:每个任务取得数据库连接后调用process_db(),不使用actor_model*/
+    threadpool(int actor_model, connection_pool *connPool, int thread_number = 8, int max_request = 10000, bool db_executor = false);
     ~threadpool();
     bool append(T *request, int state);
     bool append_p(T *request);
+    int queue_size();
+
+    //线程数在[min_threads, max_threads]之间伸缩:请求排队超过grow_wait_us且没有空闲线程时加一个线程,
+    //线程空闲idle_ms后退出;max_threads不大于min_threads时线程数固定
+    void dynamic(int min_threads, int max_threads, int grow_wait_us, int idle_ms);
+
+    //伸缩情况,供监控读取
+    int threads() { return __atomic_load_n(&m_alive, __ATOMIC_RELAXED); }
+    int idle() { return __atomic_load_n(&m_idle, __ATOMIC_RELAXED); }
+    int blocked_permille() { return __atomic_load_n(&m_blocked_permille, __ATOMIC_RELAXED); }
+    long long grows() { return __atomic_load_n(&m_grows, __ATOMIC_RELAXED); }
+    long long grow_skips() { return __atomic_load_n(&m_grow_skips, __ATOMIC_RELAXED); }
+    long long shrinks() { return __atomic_load_n(&m_shrinks, __ATOMIC_RELAXED); }
 
 private:
     /*工作线程运行的函数，它不断从工作队列中取出任务并执行之*/
     static void *worker(void *arg);
+    //加线程由该线程完成,pthread_create和绑核不占用入队的事件循环线程
+    static void *manager(void *arg);
     void run();
+    bool spawn();
+    void maybe_grow(long long wait_ns);
 
 private:
     int m_thread_number;        //线程池中的线程数
     int m_max_requests;         //请求队列中允许的最大请求数
-    pthread_t *m_threads;       //描述线程池的数组，其大小为m_thread_number
     std::list<T *> m_workqueue; //请求队列
     locker m_queuelocker;       //保护请求队列的互斥锁
     sem m_queuestat;            //是否有任务需要处理
+    sem m_growstat;             //是否需要加线程
     connection_pool *m_connPool;  //数据库
     int m_actor_model;          //模型切换
+    bool m_db_executor;         //数据库执行器
+
+    //动态伸缩
+    int m_min_threads;
+    int m_max_threads;
+    long long m_grow_wait_ns;
+    int m_idle_ms;
+    int m_cpus;                 //可用的CPU数
+    int m_alive;                //当前线程数
+    int m_idle;                 //等待任务的线程数
+    int m_spawned;              //累计创建的线程数,用于轮流绑定CPU
+    long long m_last_grow_ns;
+    int m_blocked_permille;     //抽样任务中不占CPU的时间比例(千分比),指数平均
+    long long m_grows;
+    long long m_grow_skips;     //排队过久但线程都在用CPU,不加线程的次数
+    long long m_shrinks;
 };
 template <typename T>
-threadpool<T>::threadpool( int actor_model, connection_pool *connPool, int thread_number, int max_requests) : m_actor_model(actor_model),m_thread_number(thread_number), m_max_requests(max_requests), m_threads(NULL),m_connPool(connPool)
+threadpool<T>::threadpool( int actor_model, connection_pool *connPool, int thread_number, int max_requests, bool db_executor) : m_actor_model(actor_model),m_thread_number(thread_number), m_max_requests(max_requests), m_connPool(connPool), m_db_executor(db_executor)
 {
     if (thread_number <= 0 || max_requests <= 0)
         throw std::exception();
-    m_threads = new pthread_t[m_thread_number];
-    if (!m_threads)
-        throw std::exception();
+    m_min_threads = m_max_threads = thread_number;
+    m_grow_wait_ns = 0;
+    m_idle_ms = 0;
+    m_cpus = 1;
+    m_alive = 0;
+    m_idle = 0;
+    m_spawned = 0;
+    m_last_grow_ns = 0;
+    m_blocked_permille = 0;
+    m_grows = 0;
+    m_grow_skips = 0;
+    m_shrinks = 0;
     for (int i = 0; i < thread_number; ++i)
     {
-        if (pthread_create(m_threads + i, NULL, worker, this) != 0)
-        {
-            delete[] m_threads;
-            throw std::exception();
-        }
-        if (pthread_detach(m_threads[i]))
-        {
-            delete[] m_threads;
+        if (!spawn())
             throw std::exception();
-        }
     }
 }
 template <typename T>
 threadpool<T>::~threadpool()
 {
-    delete[] m_threads;
+}
+template <typename T>
+bool threadpool<T>::spawn()
+{
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, worker, this) != 0)
+        return false;
+    //未配置时不做设置
+    Affinity::get_instance()->pin_worker(thread, __atomic_fetch_add(&m_spawned, 1, __ATOMIC_RELAXED));
+    __atomic_add_fetch(&m_alive, 1, __ATOMIC_RELAXED);
+    return pthread_detach(thread) == 0;
+}
+template <typename T>
+void threadpool<T>::dynamic(int min_threads, int max_threads, int grow_wait_us, int idle_ms)
+{
+    m_min_threads = min_threads > 0 ? min_threads : m_thread_number;
+    m_max_threads = max_threads > m_min_threads ? max_threads : m_min_threads;
+    m_grow_wait_ns = (grow_wait_us > 0 ? grow_wait_us : 1) * 1000LL;
+    m_idle_ms = idle_ms > 0 ? idle_ms : 1;
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) == 0)
+        m_cpus = CPU_COUNT(&set);
+    while (threads() < m_min_threads && spawn())
+        ;
+    if (m_max_threads > m_min_threads)
+    {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, manager, this) != 0 || pthread_detach(thread) != 0)
+            throw std::exception();
+    }
+}
+template <typename T>
+void *threadpool<T>::manager(void *arg)
+{
+    threadpool *pool = (threadpool *)arg;
+    while (true)
+    {
+        pool->m_growstat.wait();
+        if (pool->threads() < pool->m_max_threads && pool->spawn())
+            __atomic_add_fetch(&pool->m_grows, 1, __ATOMIC_RELAXED);
+    }
+    return pool;
+}
+template <typename T>
+void threadpool<T>::maybe_grow(long long wait_ns)
+{
+    if (m_max_threads <= m_min_threads || wait_ns < m_grow_wait_ns)
+        return;
+    if (idle() > 0 || threads() >= m_max_threads)
+        return;
+    //新线程开始取任务之前不重复判断
+    long long now = metrics_now_ns();
+    long long last = __atomic_load_n(&m_last_grow_ns, __ATOMIC_RELAXED);
+    if (now - last < m_grow_wait_ns || !__atomic_compare_exchange_n(&m_last_grow_ns, &last, now, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        return;
+    //线程大多在用CPU且已不少于CPU数时,加线程只会增加切换
+    if (threads() >= m_cpus && blocked_permille() < 500)
+    {
+        __atomic_add_fetch(&m_grow_skips, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    m_growstat.post();
 }
 template <typename T>
 bool threadpool<T>::append(T *request, int state)
@@ -70,9 +179,15 @@ bool threadpool<T>::append(T *request, int state)
         return false;
     }
     request->m_state = state;
+    request->m_enqueue_ns = metrics_now_ns();
+    request->enter_worker();
     m_workqueue.push_back(request);
+    TRACE_ENQUEUE(request->get_sockfd(), (int)m_workqueue.size());
+    //工作线程都阻塞时不会取任务,只能在这里发现队首等待过久
+    long long wait = request->m_enqueue_ns - m_workqueue.front()->m_enqueue_ns;
     m_queuelocker.unlock();
     m_queuestat.post();
+    maybe_grow(wait);
     return true;
 }
 template <typename T>
@@ -84,12 +199,25 @@ bool threadpool<T>::append_p(T *request)
         m_queuelocker.unlock();
         return false;
     }
+    request->m_enqueue_ns = metrics_now_ns();
+    request->enter_worker();
     m_workqueue.push_back(request);
+    TRACE_ENQUEUE(request->get_sockfd(), (int)m_workqueue.size());
+    long long wait = request->m_enqueue_ns - m_workqueue.front()->m_enqueue_ns;
     m_queuelocker.unlock();
     m_queuestat.post();
+    maybe_grow(wait);
     return true;
 }
 template <typename T>
+int threadpool<T>::queue_size()
+{
+    m_queuelocker.lock();
+    int size = m_workqueue.size();
+    m_queuelocker.unlock();
+    return size;
+}
+template <typename T>
 void *threadpool<T>::worker(void *arg)
 {
     threadpool *pool = (threadpool *)arg;
@@ -99,9 +227,24 @@ void *threadpool<T>::worker(void *arg)
 template <typename T>
 void threadpool<T>::run()
 {
+    static __thread unsigned int counter = 0;
     while (true)
     {
-        m_queuestat.wait();
+        bool dynamic = m_max_threads > m_min_threads;
+        __atomic_add_fetch(&m_idle, 1, __ATOMIC_RELAXED);
+        bool got = dynamic ? m_queuestat.timedwait(m_idle_ms) : m_queuestat.wait();
+        __atomic_sub_fetch(&m_idle, 1, __ATOMIC_RELAXED);
+        //空闲超时,线程数多于下限时退出
+        if (!got && dynamic)
+        {
+            int alive = threads();
+            if (alive > m_min_threads && __atomic_compare_exchange_n(&m_alive, &alive, alive - 1, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            {
+                __atomic_add_fetch(&m_shrinks, 1, __ATOMIC_RELAXED);
+                return;
+            }
+            continue;
+        }
         m_queuelocker.lock();
         if (m_workqueue.empty())
         {
@@ -113,14 +256,25 @@ void threadpool<T>::run()
         m_queuelocker.unlock();
         if (!request)
             continue;
-        if (1 == m_actor_model)
+        long long start = metrics_now_ns();
+        Metrics::get_instance()->record_latency(m_db_executor ? PHASE_DB_QUEUE : PHASE_QUEUE, request->m_enqueue_ns, start);
+        if (dynamic)
+            maybe_grow(start - request->m_enqueue_ns);
+        //每16个任务抽样一次CPU时间,读线程CPU时间是一次系统调用
+        long long cpu = (dynamic && (counter++ & 15) == 0) ? thread_cpu_ns() : -1;
+        if (m_db_executor)
+        {
+            //连接都被占用时在这里等待,不影响处理静态请求的线程
+            connectionRAII mysqlcon(&request->mysql, m_connPool);
+            request->process_db();
+        }
+        else if (1 == m_actor_model)
         {
             if (0 == request->m_state)
             {
                 if (request->read_once())
                 {
                     request->improv = 1;
-                    connectionRAII mysqlcon(&request->mysql, m_connPool);
                     request->process();
                 }
                 else
@@ -134,6 +288,9 @@ void threadpool<T>::run()
                 if (request->write())
                 {
                     request->improv = 1;
+                    //pipeline中的后续请求已在读缓冲区中,接着处理
+                    if (request->pipelined())
+                        request->process();
                 }
                 else
                 {
@@ -144,9 +301,23 @@ void threadpool<T>::run()
         }
         else
         {
-            connectionRAII mysqlcon(&request->mysql, m_connPool);
             request->process();
         }
+        if (cpu >= 0)
+        {
+            long long wall = metrics_now_ns() - start;
+            cpu = thread_cpu_ns() - cpu;
+            if (wall > 0)
+            {
+                int blocked = wall > cpu ? (wall - cpu) * 1000 / wall : 0;
+                //各工作线程同时更新,用CAS避免丢失抽样
+                int old = blocked_permille();
+                while (!__atomic_compare_exchange_n(&m_blocked_permille, &old, (old * 7 + blocked) / 8, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                    ;
+            }
+        }
+        //此后事件循环才可以关闭或复用这个连接对象
+        request->leave_worker();
     }
 }
 #endif
@@ -5,6 +5,7 @@ sort_timer_lst::sort_timer_lst()
 {
     head = NULL;
     tail = NULL;
+    m_size = 0;
 }
 sort_timer_lst::~sort_timer_lst()
 {
@@ -23,6 +24,7 @@ void sort_timer_lst::add_timer(util_timer *timer)
     {
         return;
     }
+    ++m_size;
     if (!head)
     {
         head = tail = timer;
@@ -68,6 +70,7 @@ void sort_timer_lst::del_timer(util_timer *timer)
     {
         return;
     }
+    --m_size;
     if ((timer == head) && (timer == tail))
     {
         delete timer;
@@ -109,6 +112,7 @@ void sort_timer_lst::tick()
             break;
         }
         tmp->cb_func(tmp->user_data);
+        --m_size;
         head = tmp->next;
         if (head)
         {
@@ -163,7 +167,8 @@ int Utils::setnonblocking(int fd)
 void Utils::addfd(int epollfd, int fd, bool one_shot, int TRIGMode)
 {
     epoll_event event;
-    event.data.fd = fd;
+    //高32位为0,与以连接key注册的客户连接区分
+    event.data.u64 = fd;
 
     if (1 == TRIGMode)
         event.events = EPOLLIN | EPOLLET | EPOLLRDHUP;
@@ -213,12 +218,23 @@ void Utils::show_error(int connfd, const char *info)
 
 int *Utils::u_pipefd = 0;
 int Utils::u_epollfd = 0;
+bool Utils::u_uring = false;
 
 class Utils;
 void cb_func(client_data *user_data)
 {
-    epoll_ctl(Utils::u_epollfd, EPOLL_CTL_DEL, user_data->sockfd, 0);
     assert(user_data);
+    //不使用EPOLLONESHOT时close会把socket从epoll中移除,省去一次epoll_ctl
+    if (!http_conn::m_notify)
+    {
+        epoll_ctl(Utils::u_epollfd, EPOLL_CTL_DEL, user_data->sockfd, 0);
+        metrics_add(Metrics::local()->epoll_ctls);
+    }
+    //io_uring中挂起的recv持有socket的引用,只close不会结束它
+    if (Utils::u_uring)
+        shutdown(user_data->sockfd, SHUT_RDWR);
     close(user_data->sockfd);
+    //io_uring后端据此丢弃已关闭连接迟到的完成事件
+    user_data->timer = NULL;
     http_conn::m_user_count--;
 }
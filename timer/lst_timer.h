@@ -28,7 +28,6 @@ class util_timer;
 
 struct client_data
 {
-    sockaddr_in address;
     int sockfd;
     util_timer *timer;
 };
@@ -57,12 +56,14 @@ public:
     void adjust_timer(util_timer *timer);
     void del_timer(util_timer *timer);
     void tick();
+    int size() { return m_size; }
 
 private:
     void add_timer(util_timer *timer, util_timer *lst_head);
 
     util_timer *head;
     util_timer *tail;
+    int m_size; //链表中的定时器数量
 };
 
 class Utils
@@ -94,6 +95,7 @@ public:
     static int *u_pipefd;
     sort_timer_lst m_timer_lst;
     static int u_epollfd;
+    static bool u_uring; //使用io_uring后端
     int m_TIMESLOT;
 };
 
@@ -0,0 +1,29 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+//静态探针,编译时加-DUSE_SDT(make SDT=1)启用,需要systemtap的sys/sdt.h
+//未启用时展开为空语句,没有任何运行时开销
+#ifdef USE_SDT
+#include <sys/sdt.h>
+
+#define TRACE_ACCEPT(fd) DTRACE_PROBE1(tinywebserver, accept, fd)
+#define TRACE_ENQUEUE(fd, depth) DTRACE_PROBE2(tinywebserver, enqueue, fd, depth)
+#define TRACE_PARSE_DONE(fd, method, url) DTRACE_PROBE3(tinywebserver, parse_done, fd, method, url)
+#define TRACE_DO_REQUEST(fd, code, db) DTRACE_PROBE3(tinywebserver, do_request, fd, code, db)
+#define TRACE_WRITE_PARTIAL(fd, sent, left) DTRACE_PROBE3(tinywebserver, write_partial, fd, sent, left)
+#define TRACE_WRITE_DONE(fd, status, bytes) DTRACE_PROBE3(tinywebserver, write_done, fd, status, bytes)
+#define TRACE_TIMER_EXPIRE(fd) DTRACE_PROBE1(tinywebserver, timer_expire, fd)
+
+#else
+
+#define TRACE_ACCEPT(fd) do {} while (0)
+#define TRACE_ENQUEUE(fd, depth) do {} while (0)
+#define TRACE_PARSE_DONE(fd, method, url) do {} while (0)
+#define TRACE_DO_REQUEST(fd, code, db) do {} while (0)
+#define TRACE_WRITE_PARTIAL(fd, sent, left) do {} while (0)
+#define TRACE_WRITE_DONE(fd, status, bytes) do {} while (0)
+#define TRACE_TIMER_EXPIRE(fd) do {} while (0)
+
+#endif
+
+#endif
@@ -0,0 +1,176 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "upgrade.h"
+
+//一次最多传递的监听socket数
+static const int MAX_FDS = 64;
+
+//请求与应答各一个字节,监听socket附在旧进程的应答中
+static const char REQ_FDS = 'F';
+static const char ACK_FDS = 'L';
+static const char READY = 'R';
+
+static bool make_addr(const string &path, sockaddr_un &addr)
+{
+    if (path.size() >= sizeof(addr.sun_path))
+        return false;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path.c_str());
+    return true;
+}
+
+bool Upgrade::takeover(const string &path, vector<int> &fds)
+{
+    fds.clear();
+    sockaddr_un addr;
+    if (!make_addr(path, addr))
+        return false;
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return false;
+    //文件不存在或旧进程已退出
+    if (connect(fd, (sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        close(fd);
+        return false;
+    }
+
+    char c = REQ_FDS;
+    char control[CMSG_SPACE(sizeof(int) * MAX_FDS)];
+    iovec iov = {&c, 1};
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if (write(fd, &c, 1) != 1 || recvmsg(fd, &msg, MSG_CMSG_CLOEXEC) != 1 || c != ACK_FDS)
+    {
+        close(fd);
+        return false;
+    }
+    for (cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm))
+    {
+        if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS)
+            continue;
+        int n = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        int *p = (int *)CMSG_DATA(cm);
+        fds.insert(fds.end(), p, p + n);
+    }
+    //旧进程在收到READY之前继续accept,连接保持到serve()
+    m_old = fd;
+    return true;
+}
+
+bool Upgrade::serve(const string &path, const vector<int> &fds, int drain_sig)
+{
+    if (m_old >= 0)
+    {
+        char c = READY;
+        if (write(m_old, &c, 1) != 1)
+            printf("notify old server failed: %s\n", strerror(errno));
+        close(m_old);
+        m_old = -1;
+    }
+
+    sockaddr_un addr;
+    if (!make_addr(path, addr))
+    {
+        printf("upgrade socket path too long: %s\n", path.c_str());
+        return false;
+    }
+    m_listen = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (m_listen < 0)
+        return false;
+    //旧进程的unix socket仍在监听,删除路径后绑定,之后的升级请求都交给本进程
+    unlink(path.c_str());
+    if (bind(m_listen, (sockaddr *)&addr, sizeof(addr)) < 0 || listen(m_listen, 1) < 0)
+    {
+        printf("upgrade socket %s: %s\n", path.c_str(), strerror(errno));
+        close(m_listen);
+        m_listen = -1;
+        return false;
+    }
+    m_fds = fds;
+    m_drain_sig = drain_sig;
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, worker, this) != 0)
+        return false;
+    pthread_detach(thread);
+    return true;
+}
+
+void *Upgrade::worker(void *arg)
+{
+    //信号由其他线程处理,升级线程只阻塞在accept和read上
+    sigset_t set;
+    sigfillset(&set);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+    ((Upgrade *)arg)->run();
+    return NULL;
+}
+
+void Upgrade::run()
+{
+    while (true)
+    {
+        int conn = accept4(m_listen, NULL, NULL, SOCK_CLOEXEC);
+        if (conn < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            break;
+        }
+        bool done = handover(conn);
+        close(conn);
+        //已交给新进程,本进程开始退出,不再接受升级请求
+        if (done)
+        {
+            kill(getpid(), m_drain_sig);
+            break;
+        }
+    }
+    close(m_listen);
+    m_listen = -1;
+}
+
+bool Upgrade::handover(int conn)
+{
+    char c;
+    if (read(conn, &c, 1) != 1 || c != REQ_FDS)
+        return false;
+
+    int n = m_fds.size() < (size_t)MAX_FDS ? m_fds.size() : MAX_FDS;
+    char control[CMSG_SPACE(sizeof(int) * MAX_FDS)];
+    memset(control, 0, sizeof(control));
+    c = ACK_FDS;
+    iovec iov = {&c, 1};
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * n);
+    cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN(sizeof(int) * n);
+    memcpy(CMSG_DATA(cm), &m_fds[0], sizeof(int) * n);
+    if (sendmsg(conn, &msg, MSG_NOSIGNAL) != 1)
+        return false;
+
+    //新进程预热期间本进程照常服务;它在READY之前退出则继续等待下一次升级
+    if (read(conn, &c, 1) != 1 || c != READY)
+    {
+        printf("upgrade aborted, keep serving\n");
+        return false;
+    }
+    return true;
+}
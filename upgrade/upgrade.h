@@ -0,0 +1,42 @@
+#ifndef UPGRADE_H
+#define UPGRADE_H
+
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+//热升级:新进程通过unix socket从正在运行的进程取得监听socket(SCM_RIGHTS),
+//准备好后通知旧进程,旧进程停止accept并处理完已有连接后退出
+class Upgrade
+{
+public:
+    static Upgrade *get_instance()
+    {
+        static Upgrade instance;
+        return &instance;
+    }
+
+    //path上有进程在监听时向它请求监听socket,成功返回true;没有进程在监听时返回false,正常启动
+    bool takeover(const string &path, vector<int> &fds);
+
+    //开始提供服务:有接管的旧进程时通知它退出,然后监听path等待下一次升级,
+    //收到升级请求时把fds交给新进程,新进程准备好后向本进程发送drain_sig
+    bool serve(const string &path, const vector<int> &fds, int drain_sig);
+
+private:
+    Upgrade() : m_old(-1), m_listen(-1), m_drain_sig(0) {}
+    ~Upgrade() {}
+    static void *worker(void *arg);
+    void run();
+    bool handover(int conn);
+
+private:
+    int m_old;          //与旧进程的连接,通知它退出后关闭
+    int m_listen;       //等待升级请求的unix socket
+    vector<int> m_fds;
+    int m_drain_sig;
+};
+
+#endif
@@ -0,0 +1,291 @@
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include "uring.h"
+
+static int sys_io_uring_setup(unsigned entries, io_uring_params *p)
+{
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+uring::uring()
+    : m_fd(-1), m_sq_ptr(MAP_FAILED), m_sq_len(0), m_cq_ptr(MAP_FAILED), m_cq_len(0), m_sqes_len(0),
+      m_buf_ring(NULL), m_buf_ring_len(0), m_bufs(NULL), m_buf_count(0), m_buf_size(0), m_group(0)
+{
+    m_sqes = (io_uring_sqe *)MAP_FAILED;
+}
+
+uring::~uring()
+{
+    if (m_bufs)
+        munmap(m_bufs, (size_t)m_buf_count * m_buf_size);
+    if (m_buf_ring)
+        munmap(m_buf_ring, m_buf_ring_len);
+    if (m_sqes != MAP_FAILED)
+        munmap(m_sqes, m_sqes_len);
+    if (m_cq_ptr != MAP_FAILED && m_cq_ptr != m_sq_ptr)
+        munmap(m_cq_ptr, m_cq_len);
+    if (m_sq_ptr != MAP_FAILED)
+        munmap(m_sq_ptr, m_sq_len);
+    if (m_fd >= 0)
+        close(m_fd);
+}
+
+bool uring::init(unsigned entries)
+{
+    io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    //CQ放大到4倍,连接多时multishot accept和recv的完成事件不易溢出
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = entries * 4;
+    m_fd = sys_io_uring_setup(entries, &p);
+    if (m_fd < 0)
+        return false;
+
+    m_sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    m_cq_len = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    //5.4以后SQ和CQ共用一次映射
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (m_cq_len > m_sq_len)
+            m_sq_len = m_cq_len;
+        m_cq_len = m_sq_len;
+    }
+    m_sq_ptr = mmap(0, m_sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+    if (m_sq_ptr == MAP_FAILED)
+        return false;
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        m_cq_ptr = m_sq_ptr;
+    else
+    {
+        m_cq_ptr = mmap(0, m_cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+        if (m_cq_ptr == MAP_FAILED)
+            return false;
+    }
+    m_sqes_len = p.sq_entries * sizeof(io_uring_sqe);
+    m_sqes = (io_uring_sqe *)mmap(0, m_sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+    if (m_sqes == MAP_FAILED)
+        return false;
+
+    char *sq = (char *)m_sq_ptr;
+    m_sq_head = (unsigned *)(sq + p.sq_off.head);
+    m_sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    m_sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    m_sq_array = (unsigned *)(sq + p.sq_off.array);
+    m_sq_entries = p.sq_entries;
+    m_sq_local_tail = *m_sq_tail;
+    m_sq_submitted = m_sq_local_tail;
+    //提交项与数组下标一一对应
+    for (unsigned i = 0; i < m_sq_entries; ++i)
+        m_sq_array[i] = i;
+
+    char *cq = (char *)m_cq_ptr;
+    m_cq_head = (unsigned *)(cq + p.cq_off.head);
+    m_cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    m_cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    m_cqes = (io_uring_cqe *)(cq + p.cq_off.cqes);
+    return true;
+}
+
+bool uring::setup_buffers(uint16_t group, unsigned count, unsigned size)
+{
+    m_buf_ring_len = count * sizeof(io_uring_buf);
+    void *ring = mmap(0, m_buf_ring_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring == MAP_FAILED)
+        return false;
+    m_buf_ring = (io_uring_buf_ring *)ring;
+
+    //5.19以后支持,与multishot accept同一版本
+    io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (unsigned long long)ring;
+    reg.ring_entries = count;
+    reg.bgid = group;
+    if (sys_io_uring_register(m_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+    {
+        munmap(ring, m_buf_ring_len);
+        m_buf_ring = NULL;
+        return false;
+    }
+
+    void *bufs = mmap(0, (size_t)count * size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (bufs == MAP_FAILED)
+        return false;
+    m_bufs = (char *)bufs;
+    m_buf_count = count;
+    m_buf_size = size;
+    m_group = group;
+    for (unsigned i = 0; i < count; ++i)
+        recycle(i);
+    return true;
+}
+
+void uring::recycle(uint16_t bid)
+{
+    uint16_t tail = m_buf_ring->tail;
+    //头文件中的bufs在C++下因空结构体偏移了8字节,直接按数组访问
+    io_uring_buf *buf = (io_uring_buf *)m_buf_ring + (tail & (m_buf_count - 1));
+    buf->addr = (unsigned long long)buffer(bid);
+    buf->len = m_buf_size;
+    buf->bid = bid;
+    __atomic_store_n(&m_buf_ring->tail, (uint16_t)(tail + 1), __ATOMIC_RELEASE);
+}
+
+bool uring::reserve(unsigned n)
+{
+    //内核每接收一批就腾出同样多的位置,直到够用或内核不再接收
+    while (m_sq_entries - (m_sq_local_tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE)) < n)
+    {
+        if (submit(0) <= 0)
+            return false;
+    }
+    return true;
+}
+
+io_uring_sqe *uring::get_sqe()
+{
+    if (!reserve(1))
+        return NULL;
+    io_uring_sqe *sqe = &m_sqes[m_sq_local_tail & *m_sq_mask];
+    m_sq_local_tail++;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+int uring::submit(unsigned wait_nr)
+{
+    unsigned to_submit = m_sq_local_tail - m_sq_submitted;
+    __atomic_store_n(m_sq_tail, m_sq_local_tail, __ATOMIC_RELEASE);
+    unsigned flags = wait_nr ? IORING_ENTER_GETEVENTS : 0;
+    if (to_submit == 0 && wait_nr == 0)
+        return 0;
+    int ret = sys_io_uring_enter(m_fd, to_submit, wait_nr, flags);
+    if (ret < 0)
+        return -errno;
+    m_sq_submitted += ret;
+    return ret;
+}
+
+io_uring_cqe *uring::peek()
+{
+    unsigned head = *m_cq_head;
+    if (head == __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE))
+        return NULL;
+    return &m_cqes[head & *m_cq_mask];
+}
+
+void uring::seen()
+{
+    __atomic_store_n(m_cq_head, *m_cq_head + 1, __ATOMIC_RELEASE);
+}
+
+bool uring::prep_accept(int fd, unsigned long long data)
+{
+    io_uring_sqe *sqe = get_sqe();
+    if (!sqe)
+        return false;
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    //一次提交持续接受新连接,直到出错
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->user_data = data;
+    return true;
+}
+
+bool uring::prep_recv(int fd, unsigned len, unsigned long long data)
+{
+    io_uring_sqe *sqe = get_sqe();
+    if (!sqe)
+        return false;
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    //数据到达时才从buffer ring中取缓冲区
+    sqe->len = len < m_buf_size ? len : m_buf_size;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = m_group;
+    sqe->user_data = data;
+    return true;
+}
+
+bool uring::prep_sendmsg(int fd, const struct msghdr *msg, int flags, unsigned long long data)
+{
+    io_uring_sqe *sqe = get_sqe();
+    if (!sqe)
+        return false;
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long long)msg;
+    sqe->len = 1;
+    sqe->msg_flags = flags | MSG_NOSIGNAL;
+    sqe->user_data = data;
+    return true;
+}
+
+bool uring::prep_poll(int fd, unsigned events, unsigned long long data)
+{
+    io_uring_sqe *sqe = get_sqe();
+    if (!sqe)
+        return false;
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = events;
+    sqe->user_data = data;
+    return true;
+}
+
+bool uring::prep_splice(int in_fd, long long in_off, int out_fd, unsigned len, unsigned flags, bool link, unsigned long long data)
+{
+    io_uring_sqe *sqe = get_sqe();
+    if (!sqe)
+        return false;
+    sqe->opcode = IORING_OP_SPLICE;
+    sqe->fd = out_fd;
+    sqe->off = (unsigned long long)-1;
+    sqe->splice_fd_in = in_fd;
+    sqe->splice_off_in = (unsigned long long)in_off;
+    sqe->len = len;
+    sqe->splice_flags = flags;
+    if (link)
+        sqe->flags = IOSQE_IO_LINK;
+    sqe->user_data = data;
+    return true;
+}
+
+bool uring::prep_cancel(unsigned long long target, unsigned long long data)
+{
+    io_uring_sqe *sqe = get_sqe();
+    if (!sqe)
+        return false;
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = target;
+    sqe->user_data = data;
+    return true;
+}
+
+bool uring::prep_read(int fd, void *buf, unsigned len, unsigned long long data)
+{
+    io_uring_sqe *sqe = get_sqe();
+    if (!sqe)
+        return false;
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long long)buf;
+    sqe->len = len;
+    sqe->off = (unsigned long long)-1;
+    sqe->user_data = data;
+    return true;
+}
@@ -0,0 +1,85 @@
+#ifndef URING_H
+#define URING_H
+
+#include <linux/io_uring.h>
+#include <sys/socket.h>
+#include <stdint.h>
+
+//直接通过系统调用使用io_uring,不依赖liburing
+//只由事件循环所在的线程使用,不加锁
+class uring
+{
+public:
+    uring();
+    ~uring();
+
+    //entries为提交队列长度;内核不支持时返回false
+    bool init(unsigned entries);
+    //注册provided buffer ring,count个大小为size的缓冲区,count须为2的幂
+    bool setup_buffers(uint16_t group, unsigned count, unsigned size);
+
+    //确保至少有n个空闲的提交项,不够时先提交已准备的;
+    //内核暂时不接收新的提交(如完成队列积压时返回EBUSY)时返回false,收割完成事件后再试
+    bool reserve(unsigned n);
+    //取一个空闲的提交项,已清零;没有时返回NULL
+    io_uring_sqe *get_sqe();
+    //提交已准备的提交项,并至少等待wait_nr个完成事件
+    int submit(unsigned wait_nr);
+
+    //依次处理完成事件,返回NULL表示没有更多
+    io_uring_cqe *peek();
+    void seen();
+
+    //provided buffer的地址,以及用完后归还
+    char *buffer(uint16_t bid) { return m_bufs + (size_t)bid * m_buf_size; }
+    void recycle(uint16_t bid);
+    uint16_t group() const { return m_group; }
+    unsigned buffer_size() const { return m_buf_size; }
+
+    //常用操作的准备,没有空闲的提交项时返回false,操作没有提交
+    bool prep_accept(int fd, unsigned long long data);
+    bool prep_recv(int fd, unsigned len, unsigned long long data);
+    bool prep_sendmsg(int fd, const struct msghdr *msg, int flags, unsigned long long data);
+    bool prep_poll(int fd, unsigned events, unsigned long long data);
+    bool prep_read(int fd, void *buf, unsigned len, unsigned long long data);
+    //splice,in_off为-1表示in_fd是管道;link为true时与下一个提交项链接,
+    //本操作没有全部完成时下一个以-ECANCELED结束
+    bool prep_splice(int in_fd, long long in_off, int out_fd, unsigned len, unsigned flags, bool link, unsigned long long data);
+    //取消user_data为target的操作,如multishot accept
+    bool prep_cancel(unsigned long long target, unsigned long long data);
+
+private:
+    int m_fd;
+
+    //提交队列
+    unsigned *m_sq_head;
+    unsigned *m_sq_tail;
+    unsigned *m_sq_mask;
+    unsigned *m_sq_array;
+    io_uring_sqe *m_sqes;
+    unsigned m_sq_entries;
+    unsigned m_sq_local_tail; //已准备但未提交的位置
+    unsigned m_sq_submitted;
+
+    //完成队列
+    unsigned *m_cq_head;
+    unsigned *m_cq_tail;
+    unsigned *m_cq_mask;
+    io_uring_cqe *m_cqes;
+
+    void *m_sq_ptr;
+    size_t m_sq_len;
+    void *m_cq_ptr;
+    size_t m_cq_len;
+    size_t m_sqes_len;
+
+    //provided buffer
+    io_uring_buf_ring *m_buf_ring;
+    size_t m_buf_ring_len;
+    char *m_bufs;
+    unsigned m_buf_count;
+    unsigned m_buf_size;
+    uint16_t m_group;
+};
+
+#endif
@@ -1,9 +1,99 @@
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <netinet/tcp.h>
 #include "webserver.h"
 
+//io_uring完成事件的user_data:高32位为连接的代数,中间为连接池中的位置,低8位为操作类型
+enum
+{
+    URING_ACCEPT = 0,
+    URING_SIGNAL,
+    URING_NOTIFY,
+    URING_RECV,
+    URING_SEND,
+    URING_POLLOUT,
+    URING_CANCEL,
+    URING_SPLICE_IN,
+    URING_SPLICE_OUT
+};
+
+//日志中的客户端地址
+static string peer_str(http_conn &conn)
+{
+    char buf[INET6_ADDRSTRLEN + 8];
+    format_addr(conn.get_address(), buf, sizeof(buf));
+    return buf;
+}
+
+static unsigned long long uring_data(int op, int fd, unsigned gen)
+{
+    return ((unsigned long long)gen << 32) | ((unsigned long long)fd << 8) | op;
+}
+
+//工作线程处理完请求后,把需要继续读或可以发送的连接交给事件循环
+//io_uring和不使用EPOLLONESHOT的epoll共用
+//记下交还时的代数,连接关闭后迟到的通知直接丢弃
+static locker s_notify_lock;
+static vector<WebServer::conn_notify> s_notify_list;
+static int s_notify_fd = -1;
+static pthread_t s_loop_thread;
+
+//登录注册交给数据库执行器,完成后由执行器线程生成响应并交还事件循环
+static threadpool<http_conn> *s_db_pool = NULL;
+
+static bool db_submit(http_conn *conn)
+{
+    return s_db_pool->append_p(conn);
+}
+
+static void loop_notify(http_conn *conn, int ev)
+{
+    WebServer::conn_notify n = {conn, conn->gen(), ev};
+    s_notify_lock.lock();
+    bool wake = s_notify_list.empty();
+    s_notify_list.push_back(n);
+    s_notify_lock.unlock();
+    //事件循环自己加入的通知在本轮处理,不必唤醒
+    if (wake && !pthread_equal(pthread_self(), s_loop_thread))
+    {
+        uint64_t one = 1;
+        ::write(s_notify_fd, &one, sizeof(one));
+        metrics_add(Metrics::local()->loop_wakeups);
+    }
+}
+
+//定时器回调需要访问连接池
+static WebServer *s_server;
+
+//定时器到期时连接还在工作线程中说明并不空闲,延后再检查,避免关闭工作线程仍在使用的socket
+static void expire_conn(client_data *user_data)
+{
+    assert(user_data);
+    int slot = user_data - s_server->users_timer;
+    if (s_server->users[slot].in_worker())
+    {
+        util_timer *timer = new util_timer;
+        timer->user_data = user_data;
+        timer->cb_func = expire_conn;
+        timer->expire = time(NULL) + 3 * TIMESLOT;
+        user_data->timer = timer;
+        s_server->utils.m_timer_lst.add_timer(timer);
+        return;
+    }
+    TRACE_TIMER_EXPIRE(user_data->sockfd);
+    if (s_server->m_ring)
+        s_server->uring_put_pipe(slot);
+    cb_func(user_data);
+}
+
 WebServer::WebServer()
 {
-    //http_conn类对象
+    //http_conn类对象,作为连接池按位置分配,与fd无关
     users = new http_conn[MAX_FD];
+    for (int i = 0; i < MAX_FD; ++i)
+        users[i].m_slot = i;
+    m_next_slot = 0;
+    s_server = this;
 
     //root文件夹路径
     char server_path[200];
@@ -15,17 +105,60 @@ WebServer::WebServer()
 
     //定时器
     users_timer = new client_data[MAX_FD];
+    memset(users_timer, 0, sizeof(client_data) * MAX_FD);
+
+    m_ring = NULL;
+    m_uring_slots = NULL;
+    m_uring_retry = false;
+    m_signal_armed = false;
+    m_notify_armed = false;
+    m_notify_fd = -1;
+    m_interest = NULL;
+    m_accept_pending = false;
+    m_backlog = SOMAXCONN;
+    m_accept_batch = 64;
+    memset(&m_sockopt, 0, sizeof(m_sockopt));
+    m_pool_min = 0;
+    m_pool_max = 0;
+    m_pool_grow_wait = 2000;
+    m_pool_idle = 10000;
+    m_db_pool = NULL;
+    m_db_threads = 0;
+    m_drain_timeout = 30;
+    m_draining = false;
+    m_drain_deadline = 0;
 }
 
 WebServer::~WebServer()
 {
     close(m_epollfd);
-    close(m_listenfd);
+    for (size_t i = 0; i < m_listeners.size(); ++i)
+    {
+        if (m_listeners[i].fd >= 0)
+            close(m_listeners[i].fd);
+    }
     close(m_pipefd[1]);
     close(m_pipefd[0]);
     delete[] users;
     delete[] users_timer;
     delete m_pool;
+    delete m_db_pool;
+    delete m_ring;
+    for (int i = 0; m_uring_slots && i < MAX_FD; ++i)
+    {
+        if (m_uring_slots[i].pipe[0] >= 0)
+        {
+            close(m_uring_slots[i].pipe[0]);
+            close(m_uring_slots[i].pipe[1]);
+        }
+    }
+    for (size_t i = 0; i < m_pipes.size(); ++i)
+    {
+        close(m_pipes[i].first);
+        close(m_pipes[i].second);
+    }
+    delete[] m_uring_slots;
+    delete[] m_interest;
 }
 
 void WebServer::init(int port, string user, string passWord, string databaseName, int log_write, 
@@ -44,34 +177,44 @@ void WebServer::init(int port, string user, string passWord, string databaseName
     m_actormodel = actor_model;
 }
 
-void WebServer::trig_mode()
+//-m的组合模式拆分为listenfd和connfd的触发模式
+static void split_trig(int mode, int &listen_trig, int &conn_trig)
 {
     //LT + LT
-    if (0 == m_TRIGMode)
+    if (0 == mode)
     {
-        m_LISTENTrigmode = 0;
-        m_CONNTrigmode = 0;
+        listen_trig = 0;
+        conn_trig = 0;
     }
     //LT + ET
-    else if (1 == m_TRIGMode)
+    else if (1 == mode)
     {
-        m_LISTENTrigmode = 0;
-        m_CONNTrigmode = 1;
+        listen_trig = 0;
+        conn_trig = 1;
     }
     //ET + LT
-    else if (2 == m_TRIGMode)
+    else if (2 == mode)
     {
-        m_LISTENTrigmode = 1;
-        m_CONNTrigmode = 0;
+        listen_trig = 1;
+        conn_trig = 0;
     }
     //ET + ET
-    else if (3 == m_TRIGMode)
+    else if (3 == mode)
     {
-        m_LISTENTrigmode = 1;
-        m_CONNTrigmode = 1;
+        listen_trig = 1;
+        conn_trig = 1;
     }
 }
 
+void WebServer::trig_mode()
+{
+    split_trig(m_TRIGMode, m_LISTENTrigmode, m_CONNTrigmode);
+
+    //读写事件只注册一次,须读写到EAGAIN,只能用ET
+    if (m_interest)
+        m_CONNTrigmode = 1;
+}
+
 void WebServer::log_write()
 {
     if (0 == m_close_log)
@@ -84,6 +227,66 @@ void WebServer::log_write()
     }
 }
 
+void WebServer::access_log(int sample, string fields)
+{
+    //访问日志与调试日志相互独立,关闭调试日志时仍可采样记录
+    if (sample > 0 && !AccessLog::get_instance()->init("./AccessLog", sample, fields.c_str()))
+    {
+        printf("access log init failed, fields: %s\n", fields.c_str());
+        exit(1);
+    }
+}
+
+void WebServer::compress_cache(int size_mb)
+{
+    //压缩在后台线程进行,需要make ZLIB=1
+    if (size_mb > 0 && !CompressCache::get_instance()->init((long long)size_mb << 20))
+        printf("compress cache disabled, rebuild with make ZLIB=1\n");
+}
+
+void WebServer::io_backend(int io_uring, int epoll_oneshot)
+{
+    if (io_uring)
+    {
+        //需要5.19以上的内核(multishot accept和provided buffer ring),否则退回epoll
+        m_ring = new uring;
+        if (!m_ring->init(URING_ENTRIES) || !m_ring->setup_buffers(0, URING_BUFFERS, http_conn::READ_BUFFER_SIZE))
+        {
+            printf("io_uring unavailable, using epoll\n");
+            delete m_ring;
+            m_ring = NULL;
+        }
+        else
+        {
+            m_uring_slots = new uring_slot[MAX_FD];
+            memset(m_uring_slots, 0, sizeof(uring_slot) * MAX_FD);
+            for (int i = 0; i < MAX_FD; ++i)
+                m_uring_slots[i].pipe[0] = m_uring_slots[i].pipe[1] = -1;
+            Utils::u_uring = true;
+        }
+    }
+    if (!m_ring)
+    {
+        if (epoll_oneshot)
+            return;
+        //每个请求省去两次EPOLL_CTL_MOD,连接交还事件循环时改为写eventfd,且可以合并
+        m_interest = new conn_interest[MAX_FD];
+        memset(m_interest, 0, sizeof(conn_interest) * MAX_FD);
+    }
+
+    m_notify_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    assert(m_notify_fd >= 0);
+    s_notify_fd = m_notify_fd;
+    http_conn::m_notify = loop_notify;
+
+    //收发都在事件循环中完成,工作线程只处理请求
+    if (1 == m_actormodel)
+    {
+        printf("%s uses proactor\n", m_ring ? "io_uring backend" : "epoll without oneshot");
+        m_actormodel = 0;
+    }
+}
+
 void WebServer::sql_pool()
 {
     //初始化数据库连接池
@@ -98,39 +301,445 @@ void WebServer::thread_pool()
 {
     //线程池
     m_pool = new threadpool<http_conn>(m_actormodel, m_connPool, m_thread_num);
+    m_pool->dynamic(m_pool_min, m_pool_max, m_pool_grow_wait, m_pool_idle);
+
+    //多于数据库连接数的执行器线程只会等待连接
+    m_db_pool = new threadpool<http_conn>(m_actormodel, m_connPool, m_db_threads > 0 ? m_db_threads : m_sql_num, 10000, true);
+    s_db_pool = m_db_pool;
+    http_conn::m_db_submit = db_submit;
 }
 
-void WebServer::eventListen()
+void WebServer::db_executor(int threads)
+{
+    m_db_threads = threads;
+}
+
+void WebServer::pool_size(int min_threads, int max_threads, int grow_wait_us, int idle_ms)
+{
+    m_pool_min = min_threads;
+    m_pool_max = max_threads;
+    m_pool_grow_wait = grow_wait_us;
+    m_pool_idle = idle_ms;
+}
+
+static long long gauge_user_count(void *)
+{
+    return http_conn::m_user_count;
+}
+
+static long long gauge_queue_depth(void *arg)
+{
+    return ((threadpool<http_conn> *)arg)->queue_size();
+}
+
+static long long gauge_pool_threads(void *arg)
+{
+    return ((threadpool<http_conn> *)arg)->threads();
+}
+
+static long long gauge_pool_idle(void *arg)
+{
+    return ((threadpool<http_conn> *)arg)->idle();
+}
+
+static long long gauge_pool_blocked(void *arg)
+{
+    return ((threadpool<http_conn> *)arg)->blocked_permille();
+}
+
+static long long counter_pool_grows(void *arg)
+{
+    return ((threadpool<http_conn> *)arg)->grows();
+}
+
+static long long counter_pool_grow_skips(void *arg)
+{
+    return ((threadpool<http_conn> *)arg)->grow_skips();
+}
+
+static long long counter_pool_shrinks(void *arg)
+{
+    return ((threadpool<http_conn> *)arg)->shrinks();
+}
+
+static long long gauge_db_free(void *arg)
+{
+    return ((connection_pool *)arg)->GetFreeConn();
+}
+
+static long long gauge_timers(void *arg)
+{
+    return ((sort_timer_lst *)arg)->size();
+}
+
+static long long gauge_access_log_dropped(void *)
+{
+    return AccessLog::get_instance()->dropped();
+}
+
+static long long gauge_compress_cache_bytes(void *)
+{
+    return CompressCache::get_instance()->bytes();
+}
+
+static long long gauge_compress_cache_entries(void *)
+{
+    return CompressCache::get_instance()->entries();
+}
+
+//监听socket的TCP_INFO中,tcpi_unacked为全连接队列长度,tcpi_sacked为队列上限,多个监听地址时求和
+static long long sum_listen_info(void *arg, bool limit)
+{
+    const vector<WebServer::listener> &ls = *(const vector<WebServer::listener> *)arg;
+    long long sum = 0;
+    for (size_t i = 0; i < ls.size(); ++i)
+    {
+        struct tcp_info info;
+        socklen_t len = sizeof(info);
+        if (getsockopt(ls[i].fd, IPPROTO_TCP, TCP_INFO, &info, &len) == 0)
+            sum += limit ? info.tcpi_sacked : info.tcpi_unacked;
+    }
+    return sum;
+}
+
+static long long gauge_accept_queue(void *arg)
+{
+    return sum_listen_info(arg, false);
+}
+
+static long long gauge_accept_queue_limit(void *arg)
+{
+    return sum_listen_info(arg, true);
+}
+
+//内核没有按socket统计溢出,读取/proc/net/netstat中所在网络命名空间的TcpExt计数
+static long long netstat_tcpext(void *arg)
+{
+    FILE *fp = fopen("/proc/net/netstat", "r");
+    if (!fp)
+        return 0;
+    char names[4096], values[4096];
+    long long result = 0;
+    while (fgets(names, sizeof(names), fp) && fgets(values, sizeof(values), fp))
+    {
+        if (strncmp(names, "TcpExt:", 7) != 0)
+            continue;
+        char *save1, *save2;
+        char *name = strtok_r(names, " \n", &save1);
+        char *value = strtok_r(values, " \n", &save2);
+        while (name && value)
+        {
+            if (strcmp(name, (const char *)arg) == 0)
+            {
+                result = atoll(value);
+                break;
+            }
+            name = strtok_r(NULL, " \n", &save1);
+            value = strtok_r(NULL, " \n", &save2);
+        }
+        break;
+    }
+    fclose(fp);
+    return result;
+}
+
+void WebServer::metrics(int enable)
+{
+    //计数器由各线程独立累加,瞬时值在请求/metrics时回调读取
+    Metrics *m = Metrics::get_instance();
+    m->init(enable == 1, "/metrics");
+    m->add_gauge("tws_connections", "Open client connections.", gauge_user_count, NULL);
+    m->add_gauge("tws_threadpool_queue_depth", "Requests waiting in the thread pool queue.", gauge_queue_depth, m_pool);
+    m->add_gauge("tws_threadpool_threads", "Worker threads currently running.", gauge_pool_threads, m_pool);
+    m->add_gauge("tws_threadpool_idle_threads", "Worker threads waiting for a request.", gauge_pool_idle, m_pool);
+    m->add_gauge("tws_threadpool_blocked_permille", "Sampled share of request time workers spent off CPU, in permille (dynamic pool only).", gauge_pool_blocked, m_pool);
+    m->add_counter("tws_threadpool_grow_total", "Worker threads added because requests queued too long with no idle worker.", counter_pool_grows, m_pool);
+    m->add_counter("tws_threadpool_grow_skipped_total", "Grow decisions skipped because workers were CPU-bound and threads already matched CPUs.", counter_pool_grow_skips, m_pool);
+    m->add_counter("tws_threadpool_shrink_total", "Worker threads that exited after staying idle.", counter_pool_shrinks, m_pool);
+    m->add_gauge("tws_db_free_connections", "Idle connections in the MySQL pool.", gauge_db_free, m_connPool);
+    m->add_gauge("tws_db_executor_queue_depth", "Login/register requests waiting for a database executor thread.", gauge_queue_depth, m_db_pool);
+    m->add_gauge("tws_db_executor_threads", "Database executor threads.", gauge_pool_threads, m_db_pool);
+    m->add_gauge("tws_timers", "Timers in the connection timer list.", gauge_timers, &utils.m_timer_lst);
+    m->add_gauge("tws_access_log_dropped", "Access log lines dropped because the queue was full.", gauge_access_log_dropped, NULL);
+    m->add_gauge("tws_compress_cache_bytes", "Bytes of gzip output held by the compression cache.", gauge_compress_cache_bytes, NULL);
+    m->add_gauge("tws_compress_cache_entries", "Files tracked by the compression cache.", gauge_compress_cache_entries, NULL);
+    m->add_gauge("tws_accept_queue_length", "Connections waiting in the accept queues of all listen sockets.", gauge_accept_queue, &m_listeners);
+    m->add_gauge("tws_accept_queue_limit", "Sum of accept queue limits of all listen sockets (backlog capped by somaxconn).", gauge_accept_queue_limit, &m_listeners);
+    m->add_counter("tws_listen_overflows_total", "TcpExt ListenOverflows of the network namespace: accept queue full.", netstat_tcpext, (void *)"ListenOverflows");
+    m->add_counter("tws_listen_drops_total", "TcpExt ListenDrops of the network namespace: SYNs or ACKs dropped by listen sockets.", netstat_tcpext, (void *)"ListenDrops");
+    m->add_counter("tws_fastopen_passive_total", "TcpExt TCPFastOpenPassive of the network namespace: connections accepted with data in the SYN.", netstat_tcpext, (void *)"TCPFastOpenPassive");
+    m->add_counter("tws_defer_accept_drops_total", "TcpExt TCPDeferAcceptDrop of the network namespace: handshakes dropped while waiting for request data.", netstat_tcpext, (void *)"TCPDeferAcceptDrop");
+}
+
+void WebServer::routes()
+{
+    //依赖监控是否开启,放在metrics之后
+    http_conn::init_routes();
+}
+
+void WebServer::listen_options(int backlog, int accept_batch)
+{
+    m_backlog = backlog > 0 ? backlog : SOMAXCONN;
+    m_accept_batch = accept_batch > 0 ? accept_batch : 1;
+}
+
+void WebServer::socket_options(const sock_options &opt)
+{
+    m_sockopt = opt;
+}
+
+static void set_option(int fd, int level, int name, const char *desc, int value)
+{
+    if (value <= 0)
+        return;
+    if (setsockopt(fd, level, name, &value, sizeof(value)) < 0)
+        printf("setsockopt %s failed: %s\n", desc, strerror(errno));
+}
+
+//连接由监听socket克隆而来,在监听socket上设置一次,每个连接不再多一次系统调用
+static void set_listen_options(int fd, const sock_options &opt)
+{
+    set_option(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, "TCP_DEFER_ACCEPT", opt.defer_accept);
+    //服务端还须net.ipv4.tcp_fastopen包含2
+    set_option(fd, IPPROTO_TCP, TCP_FASTOPEN, "TCP_FASTOPEN", opt.fastopen);
+    set_option(fd, IPPROTO_TCP, TCP_NODELAY, "TCP_NODELAY", opt.nodelay);
+    //接收缓冲区须在listen之前设置,握手时才能通告相应的窗口扩大因子
+    set_option(fd, SOL_SOCKET, SO_SNDBUF, "SO_SNDBUF", opt.sndbuf);
+    set_option(fd, SOL_SOCKET, SO_RCVBUF, "SO_RCVBUF", opt.rcvbuf);
+    set_option(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, "TCP_NOTSENT_LOWAT", opt.notsent_lowat);
+    //每个NUMA节点一个进程、监听同一端口时,内核把连接交给事件循环CPU与收包CPU相同的进程
+    int cpu = Affinity::get_instance()->loop_cpu();
+    if (opt.incoming_cpu && cpu >= 0)
+    {
+        set_option(fd, SOL_SOCKET, SO_REUSEPORT, "SO_REUSEPORT", 1);
+        if (setsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof(cpu)) < 0)
+            printf("setsockopt SO_INCOMING_CPU failed: %s\n", strerror(errno));
+    }
+}
+
+void WebServer::listen_addrs(const vector<string> &addrs)
+{
+    m_listen_addrs = addrs;
+}
+
+void WebServer::upgrade(const string &path, int drain_timeout)
+{
+    m_upgrade_path = path;
+    m_drain_timeout = drain_timeout;
+}
+
+//解析[地址:]端口[,触发模式],地址为IPv4、[IPv6]或*,省略或*时监听[::]
+static bool parse_listen(const string &spec, WebServer::listener &l)
+{
+    memset(&l, 0, sizeof(l));
+    l.fd = -1;
+    l.trig_mode = -1;
+    string s = spec;
+    size_t comma = s.find(',');
+    if (comma != string::npos)
+    {
+        string mode = s.substr(comma + 1);
+        if (mode.size() != 1 || mode[0] < '0' || mode[0] > '3')
+            return false;
+        l.trig_mode = mode[0] - '0';
+        s.erase(comma);
+    }
+    string host;
+    size_t colon = s.rfind(':');
+    if (colon != string::npos)
+    {
+        host = s.substr(0, colon);
+        s.erase(0, colon + 1);
+    }
+    char *end;
+    long port = strtol(s.c_str(), &end, 10);
+    if (s.empty() || *end || port <= 0 || port > 65535)
+        return false;
+
+    if (host.empty() || host == "*" || host == "[::]")
+    {
+        sockaddr_in6 *a = (sockaddr_in6 *)&l.addr;
+        a->sin6_family = AF_INET6;
+        a->sin6_addr = in6addr_any;
+        a->sin6_port = htons(port);
+        l.addrlen = sizeof(*a);
+        l.any6 = true;
+    }
+    else if (host.size() > 2 && host[0] == '[' && host[host.size() - 1] == ']')
+    {
+        sockaddr_in6 *a = (sockaddr_in6 *)&l.addr;
+        a->sin6_family = AF_INET6;
+        a->sin6_port = htons(port);
+        l.addrlen = sizeof(*a);
+        if (inet_pton(AF_INET6, host.substr(1, host.size() - 2).c_str(), &a->sin6_addr) != 1)
+            return false;
+    }
+    else
+    {
+        sockaddr_in *a = (sockaddr_in *)&l.addr;
+        a->sin_family = AF_INET;
+        a->sin_port = htons(port);
+        l.addrlen = sizeof(*a);
+        if (inet_pton(AF_INET, host.c_str(), &a->sin_addr) != 1)
+            return false;
+    }
+    return true;
+}
+
+static int listen_port(const sockaddr_storage &addr)
 {
+    if (addr.ss_family == AF_INET6)
+        return ntohs(((const sockaddr_in6 *)&addr)->sin6_port);
+    return ntohs(((const sockaddr_in *)&addr)->sin_port);
+}
+
+void WebServer::open_listener(int index)
+{
+    listener &l = m_listeners[index];
+    char name[INET6_ADDRSTRLEN + 8];
+    format_addr(&l.addr, name, sizeof(name));
+
+    //未指定触发模式的地址使用-m的设置
+    if (l.trig_mode < 0)
+    {
+        l.listen_trig = m_LISTENTrigmode;
+        l.conn_trig = m_CONNTrigmode;
+    }
+    else
+        split_trig(l.trig_mode, l.listen_trig, l.conn_trig);
+    if (m_interest)
+        l.conn_trig = 1;
+
+    //热升级时沿用旧进程的监听socket,已在队列中的连接不会丢失
+    l.fd = take_inherited(l.addr, l.any6);
+    if (l.fd >= 0)
+    {
+        l.addrlen = sizeof(l.addr);
+        getsockname(l.fd, (struct sockaddr *)&l.addr, &l.addrlen);
+        set_listen_options(l.fd, m_sockopt);
+        //对已在监听的socket再次listen只更新队列长度
+        int ret = listen(l.fd, m_backlog);
+        assert(ret >= 0);
+        return;
+    }
+
     //网络编程基础步骤
-    m_listenfd = socket(PF_INET, SOCK_STREAM, 0);
-    assert(m_listenfd >= 0);
+    l.fd = socket(l.addr.ss_family, SOCK_STREAM, 0);
+    //内核未开启IPv6时默认地址退回0.0.0.0
+    if (l.fd < 0 && l.any6 && errno == EAFNOSUPPORT)
+    {
+        int port = listen_port(l.addr);
+        sockaddr_in *a = (sockaddr_in *)&l.addr;
+        memset(&l.addr, 0, sizeof(l.addr));
+        a->sin_family = AF_INET;
+        a->sin_addr.s_addr = htonl(INADDR_ANY);
+        a->sin_port = htons(port);
+        l.addrlen = sizeof(*a);
+        l.any6 = false;
+        l.fd = socket(AF_INET, SOCK_STREAM, 0);
+    }
+    assert(l.fd >= 0);
 
     //优雅关闭连接
     if (0 == m_OPT_LINGER)
     {
         struct linger tmp = {0, 1};
-        setsockopt(m_listenfd, SOL_SOCKET, SO_LINGER, &tmp, sizeof(tmp));
+        setsockopt(l.fd, SOL_SOCKET, SO_LINGER, &tmp, sizeof(tmp));
     }
     else if (1 == m_OPT_LINGER)
     {
         struct linger tmp = {1, 1};
-        setsockopt(m_listenfd, SOL_SOCKET, SO_LINGER, &tmp, sizeof(tmp));
+        setsockopt(l.fd, SOL_SOCKET, SO_LINGER, &tmp, sizeof(tmp));
     }
 
-    int ret = 0;
-    struct sockaddr_in address;
-    bzero(&address, sizeof(address));
-    address.sin_family = AF_INET;
-    address.sin_addr.s_addr = htonl(INADDR_ANY);
-    address.sin_port = htons(m_port);
+    //[::]默认同时接受IPv4,同端口另有IPv4地址时只接受IPv6,否则bind冲突
+    if (l.addr.ss_family == AF_INET6)
+    {
+        int v6only = 1;
+        if (l.any6)
+        {
+            v6only = 0;
+            for (size_t i = 0; i < m_listeners.size(); ++i)
+            {
+                if (m_listeners[i].addr.ss_family == AF_INET && listen_port(m_listeners[i].addr) == listen_port(l.addr))
+                    v6only = 1;
+            }
+        }
+        setsockopt(l.fd, IPPROTO_IPV6, IPV6_V6ONLY, &v6only, sizeof(v6only));
+    }
 
     int flag = 1;
-    setsockopt(m_listenfd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
-    ret = bind(m_listenfd, (struct sockaddr *)&address, sizeof(address));
+    setsockopt(l.fd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+    set_listen_options(l.fd, m_sockopt);
+    int ret = bind(l.fd, (struct sockaddr *)&l.addr, l.addrlen);
+    if (ret < 0)
+        printf("bind %s failed: %s\n", name, strerror(errno));
     assert(ret >= 0);
-    ret = listen(m_listenfd, 5);
+    ret = listen(l.fd, m_backlog);
     assert(ret >= 0);
+}
+
+//从旧进程接管的socket中取出绑定在addr上的一个;[::]在内核不支持IPv6时对应0.0.0.0
+int WebServer::take_inherited(const sockaddr_storage &addr, bool any6)
+{
+    for (size_t i = 0; i < m_inherited.size(); ++i)
+    {
+        sockaddr_storage bound;
+        socklen_t len = sizeof(bound);
+        if (getsockname(m_inherited[i], (struct sockaddr *)&bound, &len) < 0 || listen_port(bound) != listen_port(addr))
+            continue;
+        bool match = false;
+        if (bound.ss_family == AF_INET6 && addr.ss_family == AF_INET6)
+            match = !memcmp(&((sockaddr_in6 *)&bound)->sin6_addr, &((sockaddr_in6 *)&addr)->sin6_addr, sizeof(in6_addr));
+        else if (bound.ss_family == AF_INET && addr.ss_family == AF_INET)
+            match = ((sockaddr_in *)&bound)->sin_addr.s_addr == ((sockaddr_in *)&addr)->sin_addr.s_addr;
+        else if (bound.ss_family == AF_INET && any6)
+            match = ((sockaddr_in *)&bound)->sin_addr.s_addr == htonl(INADDR_ANY);
+        if (match)
+        {
+            int fd = m_inherited[i];
+            m_inherited.erase(m_inherited.begin() + i);
+            return fd;
+        }
+    }
+    return -1;
+}
+
+int WebServer::listener_of(int fd)
+{
+    for (size_t i = 0; i < m_listeners.size(); ++i)
+    {
+        if (m_listeners[i].fd == fd)
+            return i;
+    }
+    return -1;
+}
+
+void WebServer::eventListen()
+{
+    //未指定--listen时监听-p端口,IPv4和IPv6都接受
+    if (m_listen_addrs.empty())
+        m_listen_addrs.push_back(to_string(m_port));
+    for (size_t i = 0; i < m_listen_addrs.size(); ++i)
+    {
+        listener l;
+        if (!parse_listen(m_listen_addrs[i], l))
+        {
+            printf("invalid listen address: %s\n", m_listen_addrs[i].c_str());
+            exit(1);
+        }
+        m_listeners.push_back(l);
+    }
+
+    //热升级:旧进程在本进程准备好之前照常服务
+    if (!m_upgrade_path.empty() && Upgrade::get_instance()->takeover(m_upgrade_path, m_inherited))
+        printf("took over %d listening sockets from the running server\n", (int)m_inherited.size());
+    for (size_t i = 0; i < m_listeners.size(); ++i)
+        open_listener(i);
+    //新配置中已去掉的地址,旧进程退出后随之关闭
+    for (size_t i = 0; i < m_inherited.size(); ++i)
+        close(m_inherited[i]);
+    m_inherited.clear();
 
     utils.init(TIMESLOT);
 
@@ -139,17 +748,29 @@ void WebServer::eventListen()
     m_epollfd = epoll_create(5);
     assert(m_epollfd != -1);
 
-    utils.addfd(m_epollfd, m_listenfd, false, m_LISTENTrigmode);
+    for (size_t i = 0; i < m_listeners.size(); ++i)
+        utils.addfd(m_epollfd, m_listeners[i].fd, false, m_listeners[i].listen_trig);
     http_conn::m_epollfd = m_epollfd;
 
-    ret = socketpair(PF_UNIX, SOCK_STREAM, 0, m_pipefd);
+    int ret = socketpair(PF_UNIX, SOCK_STREAM, 0, m_pipefd);
     assert(ret != -1);
     utils.setnonblocking(m_pipefd[1]);
     utils.addfd(m_epollfd, m_pipefd[0], false, 0);
 
+    //ET下eventfd每次写入都会通知,不需要读出计数
+    if (m_interest)
+    {
+        epoll_event event;
+        event.data.u64 = m_notify_fd;
+        event.events = EPOLLIN | EPOLLET;
+        epoll_ctl(m_epollfd, EPOLL_CTL_ADD, m_notify_fd, &event);
+    }
+
     utils.addsig(SIGPIPE, SIG_IGN);
     utils.addsig(SIGALRM, utils.sig_handler, false);
     utils.addsig(SIGTERM, utils.sig_handler, false);
+    utils.addsig(SIGUSR1, utils.sig_handler, false);
+    utils.addsig(SIGQUIT, utils.sig_handler, false);
 
     alarm(TIMESLOT);
 
@@ -158,20 +779,64 @@ void WebServer::eventListen()
     Utils::u_epollfd = m_epollfd;
 }
 
-void WebServer::timer(int connfd, struct sockaddr_in client_address)
+int WebServer::alloc_slot()
+{
+    if (http_conn::m_user_count >= MAX_FD)
+        return -1;
+    //轮流使用各个位置,刚关闭的连接对象最晚被复用;工作线程仍持有的跳过
+    for (int i = 0; i < MAX_FD; ++i)
+    {
+        int slot = m_next_slot;
+        m_next_slot = (m_next_slot + 1) % MAX_FD;
+        if (!users_timer[slot].timer && !users[slot].in_worker())
+            return slot;
+    }
+    return -1;
+}
+
+int WebServer::conn_slot(uint64_t key)
+{
+    unsigned slot = (unsigned)key;
+    //连接已关闭,或位置已分配给新连接
+    if (slot >= (unsigned)MAX_FD || users[slot].gen() != (unsigned)(key >> 32) || !users_timer[slot].timer)
+        return -1;
+    return slot;
+}
+
+void WebServer::timer(int slot, int connfd, const sockaddr_storage &client_address, int trig)
 {
-    users[connfd].init(connfd, client_address, m_root, m_CONNTrigmode, m_close_log, m_user, m_passWord, m_databaseName);
+    users[slot].init(connfd, client_address, m_root, trig, m_close_log, m_user, m_passWord, m_databaseName);
+
+    //读写事件在连接的生命周期内只注册这一次
+    if (m_interest)
+    {
+        epoll_event event;
+        event.data.u64 = users[slot].key();
+        event.events = EPOLLIN | EPOLLOUT | EPOLLET | EPOLLRDHUP;
+        epoll_ctl(m_epollfd, EPOLL_CTL_ADD, connfd, &event);
+        metrics_add(Metrics::local()->epoll_ctls);
+        m_interest[slot].want = EPOLLIN;
+        m_interest[slot].ready = 0;
+    }
+
+    //收包的CPU不在本进程的CPU中,说明网卡队列的中断亲和性与分流没有对上
+    if (m_sockopt.incoming_cpu)
+    {
+        int cpu = -1;
+        socklen_t len = sizeof(cpu);
+        if (getsockopt(connfd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &len) == 0 && cpu >= 0 && !Affinity::get_instance()->local(cpu))
+            metrics_add(Metrics::local()->accept_remote_cpu);
+    }
 
     //初始化client_data数据
     //创建定时器，设置回调函数和超时时间，绑定用户数据，将定时器添加到链表中
-    users_timer[connfd].address = client_address;
-    users_timer[connfd].sockfd = connfd;
+    users_timer[slot].sockfd = connfd;
     util_timer *timer = new util_timer;
-    timer->user_data = &users_timer[connfd];
-    timer->cb_func = cb_func;
+    timer->user_data = &users_timer[slot];
+    timer->cb_func = expire_conn;
     time_t cur = time(NULL);
     timer->expire = cur + 3 * TIMESLOT;
-    users_timer[connfd].timer = timer;
+    users_timer[slot].timer = timer;
     utils.m_timer_lst.add_timer(timer);
 }
 
@@ -186,58 +851,55 @@ void WebServer::adjust_timer(util_timer *timer)
     LOG_INFO("%s", "adjust timer once");
 }
 
-void WebServer::deal_timer(util_timer *timer, int sockfd)
+void WebServer::deal_timer(util_timer *timer, int slot)
 {
-    timer->cb_func(&users_timer[sockfd]);
+    //事件循环决定关闭时工作线程已交还连接,直接关闭
+    cb_func(&users_timer[slot]);
     if (timer)
     {
         utils.m_timer_lst.del_timer(timer);
     }
 
-    LOG_INFO("close fd %d", users_timer[sockfd].sockfd);
+    LOG_INFO("close fd %d", users_timer[slot].sockfd);
 }
 
-bool WebServer::dealclinetdata()
+bool WebServer::dealclinetdata(int index)
 {
-    struct sockaddr_in client_address;
-    socklen_t client_addrlength = sizeof(client_address);
-    if (0 == m_LISTENTrigmode)
+    listener &l = m_listeners[index];
+    struct sockaddr_storage client_address;
+    socklen_t client_addrlength;
+    l.pending = false;
+
+    //LT和ET都一次取多个连接,直接设为非阻塞,省去逐个fcntl
+    for (int n = 0; n < m_accept_batch; ++n)
     {
-        int connfd = accept(m_listenfd, (struct sockaddr *)&client_address, &client_addrlength);
+        client_addrlength = sizeof(client_address);
+        int connfd = accept4(l.fd, (struct sockaddr *)&client_address, &client_addrlength,
+                             SOCK_NONBLOCK | SOCK_CLOEXEC);
         if (connfd < 0)
         {
-            LOG_ERROR("%s:errno is:%d", "accept error", errno);
-            return false;
+            if (errno != EAGAIN)
+                LOG_ERROR("%s:errno is:%d", "accept error", errno);
+            return n > 0;
         }
-        if (http_conn::m_user_count >= MAX_FD)
+        metrics_add(Metrics::local()->accepts);
+        TRACE_ACCEPT(connfd);
+        int slot = alloc_slot();
+        if (slot < 0)
         {
+            metrics_add(Metrics::local()->accept_busy);
             utils.show_error(connfd, "Internal server busy");
             LOG_ERROR("%s", "Internal server busy");
             return false;
         }
-        timer(connfd, client_address);
+        timer(slot, connfd, client_address, l.conn_trig);
     }
 
-    else
-    {
-        while (1)
-        {
-            int connfd = accept(m_listenfd, (struct sockaddr *)&client_address, &client_addrlength);
-            if (connfd < 0)
-            {
-                LOG_ERROR("%s:errno is:%d", "accept error", errno);
-                break;
-            }
-            if (http_conn::m_user_count >= MAX_FD)
-            {
-                utils.show_error(connfd, "Internal server busy");
-                LOG_ERROR("%s", "Internal server busy");
-                break;
-            }
-            timer(connfd, client_address);
-        }
-        return false;
-    }
+    //预算用完时队列中可能还有连接:LT下监听socket会再次就绪,ET不会再通知,下一轮接着取
+    metrics_add(Metrics::local()->accept_budget);
+    l.pending = (1 == l.listen_trig);
+    if (l.pending)
+        m_accept_pending = true;
     return true;
 }
 
@@ -271,15 +933,27 @@ bool WebServer::dealwithsignal(bool &timeout, bool &stop_server)
                 stop_server = true;
                 break;
             }
+            //输出各阶段耗时分位数
+            case SIGUSR1:
+            {
+                Metrics::get_instance()->dump_latency(stderr);
+                break;
+            }
+            //停止accept,处理完已有连接后退出;热升级时由新进程触发
+            case SIGQUIT:
+            {
+                start_drain();
+                break;
+            }
             }
         }
     }
     return true;
 }
 
-void WebServer::dealwithread(int sockfd)
+void WebServer::dealwithread(int slot)
 {
-    util_timer *timer = users_timer[sockfd].timer;
+    util_timer *timer = users_timer[slot].timer;
 
     //reactor
     if (1 == m_actormodel)
@@ -290,18 +964,18 @@ void WebServer::dealwithread(int sockfd)
         }
 
         //若监测到读事件，将该事件放入请求队列
-        m_pool->append(users + sockfd, 0);
+        m_pool->append(users + slot, 0);
 
         while (true)
         {
-            if (1 == users[sockfd].improv)
+            if (1 == users[slot].improv)
             {
-                if (1 == users[sockfd].timer_flag)
+                if (1 == users[slot].timer_flag)
                 {
-                    deal_timer(timer, sockfd);
-                    users[sockfd].timer_flag = 0;
+                    deal_timer(timer, slot);
+                    users[slot].timer_flag = 0;
                 }
-                users[sockfd].improv = 0;
+                users[slot].improv = 0;
                 break;
             }
         }
@@ -309,12 +983,16 @@ void WebServer::dealwithread(int sockfd)
     else
     {
         //proactor
-        if (users[sockfd].read_once())
+        if (users[slot].read_once())
         {
-            LOG_INFO("deal with the client(%s)", inet_ntoa(users[sockfd].get_address()->sin_addr));
+            LOG_INFO("deal with the client(%s)", peer_str(users[slot]).c_str());
+
+            //缓冲区未满说明已读到EAGAIN,之后有数据时ET会再次通知
+            if (m_interest && users[slot].read_space() > 0)
+                m_interest[slot].ready &= ~EPOLLIN;
 
             //若监测到读事件，将该事件放入请求队列
-            m_pool->append_p(users + sockfd);
+            m_pool->append_p(users + slot);
 
             if (timer)
             {
@@ -323,14 +1001,14 @@ void WebServer::dealwithread(int sockfd)
         }
         else
         {
-            deal_timer(timer, sockfd);
+            deal_timer(timer, slot);
         }
     }
 }
 
-void WebServer::dealwithwrite(int sockfd)
+void WebServer::dealwithwrite(int slot)
 {
-    util_timer *timer = users_timer[sockfd].timer;
+    util_timer *timer = users_timer[slot].timer;
     //reactor
     if (1 == m_actormodel)
     {
@@ -339,18 +1017,18 @@ void WebServer::dealwithwrite(int sockfd)
             adjust_timer(timer);
         }
 
-        m_pool->append(users + sockfd, 1);
+        m_pool->append(users + slot, 1);
 
         while (true)
         {
-            if (1 == users[sockfd].improv)
+            if (1 == users[slot].improv)
             {
-                if (1 == users[sockfd].timer_flag)
+                if (1 == users[slot].timer_flag)
                 {
-                    deal_timer(timer, sockfd);
-                    users[sockfd].timer_flag = 0;
+                    deal_timer(timer, slot);
+                    users[slot].timer_flag = 0;
                 }
-                users[sockfd].improv = 0;
+                users[slot].improv = 0;
                 break;
             }
         }
@@ -358,9 +1036,17 @@ void WebServer::dealwithwrite(int sockfd)
     else
     {
         //proactor
-        if (users[sockfd].write())
+        if (users[slot].write())
         {
-            LOG_INFO("send data to the client(%s)", inet_ntoa(users[sockfd].get_address()->sin_addr));
+            LOG_INFO("send data to the client(%s)", peer_str(users[slot]).c_str());
+
+            //还有未发出的内容说明socket已写满,可写时ET会再次通知
+            if (m_interest && users[slot].sending())
+                m_interest[slot].ready &= ~EPOLLOUT;
+
+            //pipeline中的后续请求已在读缓冲区中,直接交给工作线程
+            if (users[slot].pipelined())
+                m_pool->append_p(users + slot);
 
             if (timer)
             {
@@ -369,42 +1055,99 @@ void WebServer::dealwithwrite(int sockfd)
         }
         else
         {
-            deal_timer(timer, sockfd);
+            deal_timer(timer, slot);
         }
     }
 }
 
 void WebServer::eventLoop()
 {
+    //后台线程都已创建,主线程从整个CPU集合收窄到事件循环的CPU
+    Affinity::get_instance()->pin_loop();
+
+    //预热已完成,通知旧进程退出,并等待下一次升级
+    if (!m_upgrade_path.empty())
+    {
+        vector<int> fds;
+        for (size_t i = 0; i < m_listeners.size(); ++i)
+            fds.push_back(m_listeners[i].fd);
+        Upgrade::get_instance()->serve(m_upgrade_path, fds, SIGQUIT);
+    }
+
+    if (m_ring)
+    {
+        uring_loop();
+        return;
+    }
+
     bool timeout = false;
     bool stop_server = false;
 
+    s_loop_thread = pthread_self();
     while (!stop_server)
     {
-        int number = epoll_wait(m_epollfd, events, MAX_EVENT_NUMBER, -1);
+        //还有未取完的连接时不阻塞
+        int number = epoll_wait(m_epollfd, events, MAX_EVENT_NUMBER, m_accept_pending ? 0 : -1);
         if (number < 0 && errno != EINTR)
         {
             LOG_ERROR("%s", "epoll failure");
             break;
         }
+        if (m_accept_pending)
+        {
+            m_accept_pending = false;
+            for (size_t i = 0; i < m_listeners.size(); ++i)
+            {
+                if (m_listeners[i].pending)
+                    dealclinetdata(i);
+            }
+        }
 
         for (int i = 0; i < number; i++)
         {
-            int sockfd = events[i].data.fd;
+            uint64_t key = events[i].data.u64;
 
-            //处理新到的客户连接
-            if (sockfd == m_listenfd)
+            //客户连接以连接池中的位置和代数注册
+            if (key >> 32)
             {
-                bool flag = dealclinetdata();
-                if (false == flag)
+                int slot = conn_slot(key);
+                //本轮前面的事件已关闭该连接,位置可能已给了新连接
+                if (slot < 0)
                     continue;
+                if (m_interest)
+                {
+                    interest_event(slot, events[i].events);
+                }
+                else if (events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+                {
+                    //服务器端关闭连接，移除对应的定时器
+                    util_timer *timer = users_timer[slot].timer;
+                    deal_timer(timer, slot);
+                }
+                //处理客户连接上接收到的数据
+                else if (events[i].events & EPOLLIN)
+                {
+                    dealwithread(slot);
+                }
+                else if (events[i].events & EPOLLOUT)
+                {
+                    dealwithwrite(slot);
+                }
+                continue;
             }
-            else if (events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+
+            int sockfd = (int)key;
+            int index = listener_of(sockfd);
+            //处理新到的客户连接
+            if (index >= 0)
             {
-                //服务器端关闭连接，移除对应的定时器
-                util_timer *timer = users_timer[sockfd].timer;
-                deal_timer(timer, sockfd);
+                bool flag = dealclinetdata(index);
+                if (false == flag)
+                    continue;
             }
+            //工作线程的通知在本轮末尾统一处理
+            else if (sockfd == m_notify_fd)
+                continue;
             //处理信号
             else if ((sockfd == m_pipefd[0]) && (events[i].events & EPOLLIN))
             {
@@ -412,23 +1155,507 @@ void WebServer::eventLoop()
                 if (false == flag)
                     LOG_ERROR("%s", "dealclientdata failure");
             }
-            //处理客户连接上接收到的数据
-            else if (events[i].events & EPOLLIN)
+        }
+        if (m_interest)
+            drain_notify();
+
+        if (timeout)
+        {
+            utils.timer_handler();
+            if (m_draining)
+                close_idle();
+
+            LOG_INFO("%s", "timer tick");
+
+            timeout = false;
+        }
+        if (m_draining && drained())
+            break;
+    }
+}
+
+void WebServer::start_drain()
+{
+    if (m_draining)
+        return;
+    m_draining = true;
+    m_drain_deadline = time(NULL) + m_drain_timeout;
+    printf("draining %d connections\n", http_conn::m_user_count);
+    LOG_INFO("draining %d connections", http_conn::m_user_count);
+
+    //停止accept;监听socket已交给新进程时,队列中的连接由新进程接受
+    for (size_t i = 0; i < m_listeners.size(); ++i)
+    {
+        listener &l = m_listeners[i];
+        //挂起的multishot accept持有socket的引用,须取消
+        if (m_ring)
+        {
+            m_uring_cancel.push_back(i);
+            m_uring_retry = true;
+        }
+        else
+            epoll_ctl(m_epollfd, EPOLL_CTL_DEL, l.fd, 0);
+        close(l.fd);
+        l.fd = -1;
+        l.pending = false;
+    }
+    m_accept_pending = false;
+
+    //之后的响应都带Connection: close,活跃的连接在下一个响应后关闭
+    __atomic_store_n(&http_conn::m_draining, true, __ATOMIC_RELAXED);
+}
+
+//退出过程中每个定时周期关闭一次空闲的keep-alive连接;
+//不在开始时立即关闭,减少客户端恰好发出下一个请求时连接被关闭的情况
+void WebServer::close_idle()
+{
+    for (int slot = 0; slot < MAX_FD; ++slot)
+    {
+        if (!users_timer[slot].timer || users[slot].in_worker() || !users[slot].idle())
+            continue;
+        if (m_interest && (m_interest[slot].ready & EPOLLIN))
+            continue;
+        char c;
+        if (recv(users[slot].get_sockfd(), &c, 1, MSG_PEEK | MSG_DONTWAIT) > 0)
+            continue;
+        if (m_ring)
+            uring_close(slot);
+        else
+            deal_timer(users_timer[slot].timer, slot);
+    }
+}
+
+bool WebServer::drained()
+{
+    if (http_conn::m_user_count > 0 && time(NULL) < m_drain_deadline)
+        return false;
+    printf("drained, %d connections left\n", http_conn::m_user_count);
+    LOG_INFO("drained, %d connections left", http_conn::m_user_count);
+    return true;
+}
+
+void WebServer::interest_event(int slot, unsigned events)
+{
+    //ET只在状态变化时通知一次,先记下,连接在工作线程中时等它交还后再处理
+    m_interest[slot].ready |= events;
+    interest_dispatch(slot);
+}
+
+void WebServer::interest_dispatch(int slot)
+{
+    conn_interest &ci = m_interest[slot];
+    if (!ci.want)
+        return;
+
+    if (ci.ready & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+    {
+        //服务器端关闭连接，移除对应的定时器
+        ci.want = 0;
+        deal_timer(users_timer[slot].timer, slot);
+    }
+    else if ((ci.want & EPOLLIN) && (ci.ready & EPOLLIN))
+    {
+        ci.want = 0;
+        dealwithread(slot);
+    }
+    else if ((ci.want & EPOLLOUT) && (ci.ready & EPOLLOUT))
+    {
+        ci.want = 0;
+        dealwithwrite(slot);
+    }
+}
+
+void WebServer::drain_notify()
+{
+    //处理过程中可能产生新的通知,直到取空为止
+    while (true)
+    {
+        s_notify_lock.lock();
+        m_notify_batch.swap(s_notify_list);
+        s_notify_lock.unlock();
+        if (m_notify_batch.empty())
+            break;
+
+        for (size_t i = 0; i < m_notify_batch.size(); ++i)
+        {
+            conn_notify &n = m_notify_batch[i];
+            int slot = conn_slot(((uint64_t)n.gen << 32) | n.conn->m_slot);
+            if (slot < 0)
+                continue;
+            if (m_ring)
             {
-                dealwithread(sockfd);
+                if (n.ev & EPOLLOUT)
+                    uring_send(slot);
+                else
+                    uring_recv(slot);
             }
-            else if (events[i].events & EPOLLOUT)
+            else
             {
-                dealwithwrite(sockfd);
+                m_interest[slot].want = n.ev;
+                interest_dispatch(slot);
             }
         }
+        m_notify_batch.clear();
+    }
+}
+
+void WebServer::uring_loop()
+{
+    bool timeout = false;
+    bool stop_server = false;
+
+    s_loop_thread = pthread_self();
+    for (size_t i = 0; i < m_listeners.size(); ++i)
+        m_listeners[i].armed = false;
+    uring_arm();
+
+    while (!stop_server)
+    {
+        //提交本轮准备的所有操作并等待完成事件,只需一次系统调用
+        //有操作待重试时不等待,收割完成事件腾出位置后再提交
+        int ret = m_ring->submit(m_uring_retry ? 0 : 1);
+        if (ret < 0 && ret != -EINTR && ret != -EBUSY && ret != -EAGAIN)
+        {
+            LOG_ERROR("%s", "io_uring failure");
+            break;
+        }
+
+        io_uring_cqe *cqe;
+        while ((cqe = m_ring->peek()) != NULL)
+        {
+            uring_complete(cqe, timeout, stop_server);
+            m_ring->seen();
+        }
+        drain_notify();
+        if (m_uring_retry)
+            uring_arm();
+
         if (timeout)
         {
             utils.timer_handler();
+            if (m_draining)
+                close_idle();
 
             LOG_INFO("%s", "timer tick");
 
             timeout = false;
         }
+        if (m_draining && drained())
+            break;
+    }
+}
+
+//提交事件循环自身的操作:取消、multishot accept、信号管道和eventfd的读,失败的留到下一轮
+void WebServer::uring_arm()
+{
+    m_uring_retry = false;
+    while (!m_uring_cancel.empty())
+    {
+        //user_data中的位置为监听地址的下标
+        if (!m_ring->prep_cancel(uring_data(URING_ACCEPT, m_uring_cancel.back(), 0), uring_data(URING_CANCEL, 0, 0)))
+        {
+            m_uring_retry = true;
+            return;
+        }
+        m_uring_cancel.pop_back();
+    }
+    for (size_t i = 0; i < m_listeners.size(); ++i)
+    {
+        listener &l = m_listeners[i];
+        if (l.fd >= 0 && !l.armed)
+            l.armed = m_ring->prep_accept(l.fd, uring_data(URING_ACCEPT, i, 0));
+        if (l.fd >= 0 && !l.armed)
+            m_uring_retry = true;
+    }
+    if (!m_signal_armed)
+        m_signal_armed = m_ring->prep_poll(m_pipefd[0], POLLIN, uring_data(URING_SIGNAL, 0, 0));
+    if (!m_notify_armed)
+        m_notify_armed = m_ring->prep_read(m_notify_fd, &m_notify_val, sizeof(m_notify_val), uring_data(URING_NOTIFY, 0, 0));
+    if (!m_signal_armed || !m_notify_armed)
+        m_uring_retry = true;
+}
+
+void WebServer::uring_complete(io_uring_cqe *cqe, bool &timeout, bool &stop_server)
+{
+    unsigned long long data = cqe->user_data;
+    int op = data & 0xff;
+    int slot = (data >> 8) & 0xffffff;
+    unsigned gen = data >> 32;
+
+    switch (op)
+    {
+    case URING_ACCEPT:
+        uring_accept(slot, cqe);
+        return;
+    case URING_SIGNAL:
+        if (!dealwithsignal(timeout, stop_server))
+            LOG_ERROR("%s", "dealclientdata failure");
+        m_signal_armed = false;
+        m_uring_retry = true;
+        return;
+    case URING_NOTIFY:
+        //通知在每轮末尾统一处理,读操作也在那时重新提交
+        m_notify_armed = false;
+        m_uring_retry = true;
+        return;
+    case URING_CANCEL:
+        return;
+    }
+
+    //连接已关闭或位置已分配给新连接
+    if (conn_slot(((uint64_t)gen << 32) | slot) < 0)
+    {
+        if (cqe->flags & IORING_CQE_F_BUFFER)
+            m_ring->recycle(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+        return;
+    }
+
+    switch (op)
+    {
+    case URING_RECV:
+        uring_recv_done(slot, cqe);
+        break;
+    case URING_SEND:
+        if (cqe->res == -EAGAIN)
+        {
+            if (!m_ring->prep_poll(users[slot].get_sockfd(), POLLOUT, uring_data(URING_POLLOUT, slot, gen)))
+                uring_close(slot);
+        }
+        else if (cqe->res <= 0)
+            uring_close(slot);
+        else
+        {
+            users[slot].sent(cqe->res);
+            uring_send(slot);
+        }
+        break;
+    case URING_POLLOUT:
+        if (cqe->res < 0)
+            uring_close(slot);
+        else
+            uring_send(slot);
+        break;
+    case URING_SPLICE_IN:
+        //文件读完或被截断,无法补齐Content-Length;链接的splice随后以-ECANCELED结束
+        if (cqe->res <= 0)
+            uring_close(slot);
+        else
+            m_uring_slots[slot].piped += cqe->res;
+        break;
+    case URING_SPLICE_OUT:
+    {
+        uring_slot &us = m_uring_slots[slot];
+        us.splicing = false;
+        //读入管道的不足请求的长度时链接被取消,管道中已有的数据由uring_send发出
+        if (cqe->res == -ECANCELED)
+            uring_send(slot);
+        else if (cqe->res == -EAGAIN)
+        {
+            if (!m_ring->prep_poll(users[slot].get_sockfd(), POLLOUT, uring_data(URING_POLLOUT, slot, gen)))
+                uring_close(slot);
+        }
+        else if (cqe->res <= 0)
+            uring_close(slot);
+        else
+        {
+            us.piped -= cqe->res;
+            users[slot].sent(cqe->res);
+            uring_send(slot);
+        }
+        break;
+    }
+    }
+}
+
+void WebServer::uring_accept(int index, io_uring_cqe *cqe)
+{
+    //multishot accept出错后不再产生事件,在本轮末尾重新提交;已停止accept时除外
+    if (!(cqe->flags & IORING_CQE_F_MORE))
+    {
+        m_listeners[index].armed = false;
+        m_uring_retry = true;
+    }
+
+    int connfd = cqe->res;
+    if (connfd == -ECANCELED)
+        return;
+    if (connfd < 0)
+    {
+        LOG_ERROR("%s:errno is:%d", "accept error", -connfd);
+        return;
+    }
+    metrics_add(Metrics::local()->accepts);
+    TRACE_ACCEPT(connfd);
+    int slot = alloc_slot();
+    if (slot < 0)
+    {
+        metrics_add(Metrics::local()->accept_busy);
+        utils.show_error(connfd, "Internal server busy");
+        LOG_ERROR("%s", "Internal server busy");
+        return;
+    }
+
+    //上一个连接没有经过uring_close关闭时,管道还留在位置上
+    uring_put_pipe(slot);
+
+    struct sockaddr_storage client_address;
+    socklen_t client_addrlength = sizeof(client_address);
+    memset(&client_address, 0, sizeof(client_address));
+    getpeername(connfd, (struct sockaddr *)&client_address, &client_addrlength);
+    timer(slot, connfd, client_address, m_listeners[index].conn_trig);
+    uring_recv(slot);
+}
+
+void WebServer::uring_recv(int slot)
+{
+    //读缓冲区已满,与read_once返回false时一样关闭连接
+    int space = users[slot].read_space();
+    if (space <= 0)
+    {
+        uring_close(slot);
+        return;
+    }
+    //提交队列满且内核暂时不接收时只能关闭,否则连接要等到超时
+    if (!m_ring->prep_recv(users[slot].get_sockfd(), space, uring_data(URING_RECV, slot, users[slot].gen())))
+    {
+        LOG_ERROR("%s", "io_uring submission queue full");
+        uring_close(slot);
+    }
+}
+
+void WebServer::uring_recv_done(int slot, io_uring_cqe *cqe)
+{
+    //缓冲区暂时用完,重新提交等待归还
+    if (cqe->res == -ENOBUFS)
+    {
+        uring_recv(slot);
+        return;
+    }
+    if (cqe->res <= 0)
+    {
+        uring_close(slot);
+        return;
+    }
+
+    //数据在provided buffer中,拷贝到连接的读缓冲区后立即归还
+    int bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+    users[slot].read_from(m_ring->buffer(bid), cqe->res);
+    m_ring->recycle(bid);
+
+    LOG_INFO("deal with the client(%s)", peer_str(users[slot]).c_str());
+    m_pool->append_p(users + slot);
+    adjust_timer(users_timer[slot].timer);
+}
+
+void WebServer::uring_send(int slot)
+{
+    http_conn *conn = users + slot;
+    uring_slot &us = m_uring_slots[slot];
+    if (us.splicing)
+        return;
+    out_chain *out = conn->output();
+    if (out->empty())
+    {
+        uring_put_pipe(slot);
+        if (!conn->finish_write())
+        {
+            uring_close(slot);
+            return;
+        }
+        LOG_INFO("send data to the client(%s)", peer_str(*conn).c_str());
+
+        //pipeline中的后续请求已在读缓冲区中,直接交给工作线程
+        if (conn->pipelined())
+            m_pool->append_p(conn);
+        adjust_timer(users_timer[slot].timer);
+        return;
+    }
+
+    int file_fd;
+    off_t offset;
+    size_t len;
+    if (out->front_file(file_fd, offset, len))
+    {
+        if (!uring_splice(slot, file_fd, offset, len, out->size()))
+            uring_close(slot);
+        return;
+    }
+
+    memset(&us.msg, 0, sizeof(us.msg));
+    us.msg.msg_iov = us.iov;
+    us.msg.msg_iovlen = out->iov(us.iov, URING_IOV);
+    size_t bytes = 0;
+    for (size_t i = 0; i < us.msg.msg_iovlen; ++i)
+        bytes += us.iov[i].iov_len;
+    //后面还有文件段时头部先不单独成包
+    if (!m_ring->prep_sendmsg(conn->get_sockfd(), &us.msg, bytes < out->size() ? MSG_MORE : 0,
+                              uring_data(URING_SEND, slot, conn->gen())))
+        uring_close(slot);
+}
+
+//io_uring没有sendfile,文件段经连接的管道用两个链接的splice发送:
+//文件到管道由内核工作线程完成,页缓存未命中时的磁盘读不会阻塞事件循环
+bool WebServer::uring_splice(int slot, int file_fd, off_t offset, size_t len, size_t total)
+{
+    uring_slot &us = m_uring_slots[slot];
+    int fd = users[slot].get_sockfd();
+    unsigned gen = users[slot].gen();
+    if (us.pipe[0] < 0)
+    {
+        if (!m_pipes.empty())
+        {
+            us.pipe[0] = m_pipes.back().first;
+            us.pipe[1] = m_pipes.back().second;
+            m_pipes.pop_back();
+        }
+        else if (pipe2(us.pipe, O_CLOEXEC) < 0)
+        {
+            LOG_ERROR("pipe failure: errno is:%d", errno);
+            return false;
+        }
     }
-}
\ No newline at end of file
+
+    //上次没有全部发出的数据还在管道中,先发送这部分
+    if (us.piped > 0)
+    {
+        if (!m_ring->prep_splice(us.pipe[0], -1, fd, us.piped, us.piped < total ? SPLICE_F_MORE : 0,
+                                 false, uring_data(URING_SPLICE_OUT, slot, gen)))
+            return false;
+        us.splicing = true;
+        return true;
+    }
+
+    size_t n = len < (size_t)URING_SPLICE ? len : URING_SPLICE;
+    if (!m_ring->reserve(2))
+        return false;
+    m_ring->prep_splice(file_fd, offset, us.pipe[1], n, 0, true, uring_data(URING_SPLICE_IN, slot, gen));
+    m_ring->prep_splice(us.pipe[0], -1, fd, n, n < total ? SPLICE_F_MORE : 0,
+                        false, uring_data(URING_SPLICE_OUT, slot, gen));
+    us.splicing = true;
+    return true;
+}
+
+//空的管道归还给m_pipes;还有数据或未完成的splice时直接关闭,挂起的操作持有管道的引用
+void WebServer::uring_put_pipe(int slot)
+{
+    uring_slot &us = m_uring_slots[slot];
+    if (us.pipe[0] < 0)
+        return;
+    if (!us.splicing && us.piped == 0)
+        m_pipes.push_back(make_pair(us.pipe[0], us.pipe[1]));
+    else
+    {
+        close(us.pipe[0]);
+        close(us.pipe[1]);
+    }
+    us.pipe[0] = us.pipe[1] = -1;
+    us.piped = 0;
+    us.splicing = false;
+}
+
+void WebServer::uring_close(int slot)
+{
+    uring_put_pipe(slot);
+    users[slot].release_body();
+    deal_timer(users_timer[slot].timer, slot);
+}
@@ -14,10 +14,29 @@
 
 #include "./threadpool/threadpool.h"
 #include "./http/http_conn.h"
+#include "./uring/uring.h"
+#include "./affinity/affinity.h"
+#include "./upgrade/upgrade.h"
 
 const int MAX_FD = 65536;           //最大文件描述符
 const int MAX_EVENT_NUMBER = 10000; //最大事件数
 const int TIMESLOT = 5;             //最小超时单位
+const int URING_ENTRIES = 4096;     //io_uring提交队列长度
+const int URING_BUFFERS = 1024;     //recv使用的provided buffer个数
+const int URING_IOV = 16;           //一次sendmsg最多的内存段
+const int URING_SPLICE = 65536;     //一次splice搬运的最大字节数,不超过管道的默认容量
+
+//监听socket的选项,0表示不设置;除DEFER_ACCEPT和FASTOPEN外accept得到的连接都会继承
+struct sock_options
+{
+    int defer_accept;  //TCP_DEFER_ACCEPT,请求数据到达后才accept,单位秒
+    int fastopen;      //TCP_FASTOPEN队列长度
+    int nodelay;       //TCP_NODELAY
+    int sndbuf;        //SO_SNDBUF,字节
+    int rcvbuf;        //SO_RCVBUF,字节
+    int notsent_lowat; //TCP_NOTSENT_LOWAT,未发出数据低于该值才可写,字节
+    int incoming_cpu;  //SO_REUSEPORT + SO_INCOMING_CPU,同端口多个进程按收包CPU分配连接
+};
 
 class WebServer
 {
@@ -30,18 +49,54 @@ public:
               int thread_num, int close_log, int actor_model);
 
     void thread_pool();
+    void pool_size(int min_threads, int max_threads, int grow_wait_us, int idle_ms);
+    void db_executor(int threads);
+    void metrics(int enable);
+    void routes();
     void sql_pool();
     void log_write();
+    void access_log(int sample, string fields);
+    void compress_cache(int size_mb);
+    void io_backend(int io_uring, int epoll_oneshot);
+    void listen_options(int backlog, int accept_batch);
+    void socket_options(const sock_options &opt);
+    void listen_addrs(const vector<string> &addrs);
+    void upgrade(const string &path, int drain_timeout);
     void trig_mode();
     void eventListen();
+    void open_listener(int index);
+    int listener_of(int fd);
+    int take_inherited(const sockaddr_storage &addr, bool any6);
+    void start_drain();
+    void close_idle();
+    bool drained();
     void eventLoop();
-    void timer(int connfd, struct sockaddr_in client_address);
+    int alloc_slot();
+    int conn_slot(uint64_t key);
+    void timer(int slot, int connfd, const sockaddr_storage &client_address, int trig);
     void adjust_timer(util_timer *timer);
-    void deal_timer(util_timer *timer, int sockfd);
-    bool dealclinetdata();
+    void deal_timer(util_timer *timer, int slot);
+    bool dealclinetdata(int index);
     bool dealwithsignal(bool& timeout, bool& stop_server);
-    void dealwithread(int sockfd);
-    void dealwithwrite(int sockfd);
+    void dealwithread(int slot);
+    void dealwithwrite(int slot);
+
+    //epoll只注册一次时的事件分发
+    void interest_event(int slot, unsigned events);
+    void interest_dispatch(int slot);
+    void drain_notify();
+
+    //io_uring事件循环
+    void uring_loop();
+    void uring_arm();
+    void uring_complete(io_uring_cqe *cqe, bool &timeout, bool &stop_server);
+    void uring_accept(int index, io_uring_cqe *cqe);
+    void uring_recv(int slot);
+    void uring_recv_done(int slot, io_uring_cqe *cqe);
+    void uring_send(int slot);
+    bool uring_splice(int slot, int file_fd, off_t offset, size_t len, size_t total);
+    void uring_put_pipe(int slot);
+    void uring_close(int slot);
 
 public:
     //基础
@@ -53,7 +108,9 @@ public:
 
     int m_pipefd[2];
     int m_epollfd;
+    //连接池,按位置分配,事件和通知中带有位置和代数
     http_conn *users;
+    int m_next_slot;
 
     //数据库相关
     connection_pool *m_connPool;
@@ -65,11 +122,40 @@ public:
     //线程池相关
     threadpool<http_conn> *m_pool;
     int m_thread_num;
+    int m_pool_min;        //0表示与-t相同
+    int m_pool_max;        //不大于下限时线程数固定
+    int m_pool_grow_wait;  //排队超过该时间(微秒)且没有空闲线程时加线程
+    int m_pool_idle;       //线程空闲该时间(毫秒)后退出
+    threadpool<http_conn> *m_db_pool;   //数据库执行器,登录注册在其中访问数据库
+    int m_db_threads;                   //0表示与数据库连接数相同
 
     //epoll_event相关
     epoll_event events[MAX_EVENT_NUMBER];
 
-    int m_listenfd;
+    //监听地址,同一个事件循环处理所有地址上的连接
+    struct listener
+    {
+        int fd;
+        sockaddr_storage addr;
+        socklen_t addrlen;
+        bool any6;       //[::],未与IPv4地址同端口时同时接受IPv4
+        int trig_mode;   //同-m,-1表示使用-m的设置
+        int listen_trig; //listenfd触发模式
+        int conn_trig;   //该地址上连接的触发模式
+        bool pending;    //ET下上一轮预算用完,还要继续accept
+        bool armed;      //io_uring下multishot accept已提交
+    };
+    vector<string> m_listen_addrs;
+    vector<listener> m_listeners;
+    int m_backlog;
+    int m_accept_batch;   //每轮最多accept的连接数
+    bool m_accept_pending; //有监听地址的accept预算用完
+    string m_upgrade_path;     //热升级的unix socket,为空时不启用
+    vector<int> m_inherited;   //从旧进程接管、尚未对应到监听地址的socket
+    int m_drain_timeout;       //停止accept后等待已有连接的最长时间(秒)
+    bool m_draining;
+    time_t m_drain_deadline;
+    sock_options m_sockopt;
     int m_OPT_LINGER;
     int m_TRIGMode;
     int m_LISTENTrigmode;
@@ -78,5 +164,40 @@ public:
     //定时器相关
     client_data *users_timer;
     Utils utils;
+
+    //io_uring相关,m_ring为空时使用epoll
+    struct uring_slot
+    {
+        struct msghdr msg;   //sendmsg完成前须保持有效
+        struct iovec iov[URING_IOV];
+        int pipe[2];         //文件段经管道splice到socket,发送文件时从m_pipes取得
+        unsigned piped;      //已读入管道、还没有发到socket的字节数
+        bool splicing;       //有未完成的splice
+    };
+    uring *m_ring;
+    uring_slot *m_uring_slots;
+    //事件循环自身的操作在提交队列满时没能提交,收割完成事件后重试
+    bool m_uring_retry;
+    bool m_signal_armed;
+    bool m_notify_armed;
+    vector<int> m_uring_cancel; //待取消multishot accept的监听地址下标
+    vector<pair<int, int> > m_pipes; //空闲的管道,响应发送完后归还,个数不超过同时发送文件的连接数
+    int m_notify_fd;     //工作线程处理完请求后唤醒事件循环的eventfd
+    uint64_t m_notify_val;
+    struct conn_notify
+    {
+        http_conn *conn;
+        unsigned gen; //交还时的代数
+        int ev;
+    };
+    vector<conn_notify> m_notify_batch;
+
+    //--epoll-oneshot 0时,连接以ET注册一次读写事件,关注的事件在用户态记录
+    struct conn_interest
+    {
+        unsigned want;  //等待的事件,0表示连接在工作线程中
+        unsigned ready; //ET已通知、尚未读写到EAGAIN的事件
+    };
+    conn_interest *m_interest;
 };
 #endif